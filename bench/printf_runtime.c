@@ -0,0 +1,34 @@
+// The print routines as commonly implemented on top of printf, as a baseline
+// for the runtime library
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void print_boolean(int64_t b) {
+	printf("%s",b ? "true" : "false");
+}
+
+void print_character(int64_t c) {
+	putchar(c);
+}
+
+void print_integer(int64_t i) {
+	printf("%"PRIi64,i);
+}
+
+void print_string(const char *s) {
+	printf("%s",s);
+}
+
+// stdio already locks each call, and can hold its lock across several
+void print_share(void) {
+}
+
+void print_lock(void) {
+	flockfile(stdout);
+}
+
+void print_unlock(void) {
+	funlockfile(stdout);
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/bash
+
+# Compiles each benchmark and times it when linked against the in-tree runtime
+# library, against a printf-based runtime, and (if it does not need the C
+# library) as a static freestanding executable; a benchmark can also ask to be
+# timed compiled with other flags, such as ones turning an optimization off
+
+out=`mktemp -d`
+trap 'rm -rf $out' EXIT
+
+TIMEFORMAT=%R
+
+for f in bench/*.cminor
+do
+	name=`basename $f .cminor`
+
+	# A benchmark may ask to be run many times, e.g. to time startup
+	runs=`sed -n 's|^// runs: \([0-9]*\)$|\1|p' $f`
+	runs=${runs:-1}
+
+	compare=`sed -n 's|^// compare: \(.*\)$|\1|p' $f`
+
+	if ! ./cminor -codegen $f $out/$name.s
+	then
+		echo FAILED: $f
+		continue
+	fi
+
+	runtimes="libcminor printf"
+
+	cc -pthread -o $out/$name.libcminor $out/$name.s libcminor.a
+	cc -pthread -I. -o $out/$name.printf $out/$name.s \
+		bench/printf_runtime.c runtime/parallel.c
+
+	if ./cminor -codegen -freestanding $f $out/$name.s 2> /dev/null
+	then
+		runtimes="$runtimes freestanding"
+		cc -static -nostdlib -o $out/$name.freestanding $out/$name.s \
+			libcminor-freestanding.a
+	fi
+
+	if [ -n "$compare" ]
+	then
+		runtimes="$runtimes compare"
+		./cminor -codegen $compare $f $out/$name.compare.s
+		cc -pthread -o $out/$name.compare $out/$name.compare.s \
+			libcminor.a
+	fi
+
+	for runtime in $runtimes
+	do
+		if ! cmp -s <($out/$name.libcminor) <($out/$name.$runtime)
+		then
+			echo FAILED: $f "($runtime output differs)"
+			continue 2
+		fi
+	done
+
+	for runtime in $runtimes
+	do
+		seconds=`{ time for ((i = 0; i < runs; i++))
+		do
+			$out/$name.$runtime > /dev/null
+		done; } 2>&1`
+		label=$runtime
+		[ $runtime == compare ] && label="libcminor, $compare"
+		echo -e $name \($label, $runs run`[ $runs == 1 ] || echo s`\):\\t \
+			$seconds s
+	done
+done
@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "runtime/freestanding.h"
+#include "runtime/print.h"
+
+// The program's entry point, with the arguments as main() expects them
+int64_t cminor_main(int64_t, char **) __asm__("main");
+
+// The kernel starts the process here, with argc at the top of the stack and
+// argv just above it
+__asm__(
+	"\t.text\n"
+	"\t.globl _start\n"
+	"_start:\n"
+	"\txor %ebp, %ebp\n"
+	"\tmov (%rsp), %rdi\n"
+	"\tlea 8(%rsp), %rsi\n"
+	"\tand $-16, %rsp\n"
+	"\tcall cminor_start\n"
+	"\thlt\n"
+);
+
+void cminor_start(int64_t argc, char **argv) {
+	int64_t status;
+
+	status = cminor_main(argc,argv);
+	print_flush();
+
+	sys_exit(status);
+}
+
+long sys_write(int fd, const void *p, size_t len) {
+	long ret;
+
+	__asm__ volatile("syscall"
+		: "=a" (ret)
+		: "a" (1), "D" ((long) fd), "S" (p), "d" (len)
+		: "rcx", "r11", "memory");
+
+	return ret;
+}
+
+void sys_exit(int status) {
+	for(;;)
+		__asm__ volatile("syscall"
+			:
+			: "a" (231), "D" ((long) status)
+			: "rcx", "r11", "memory");
+}
+
+// The compiler may emit calls to these even in freestanding code
+void *memcpy(void *dest, const void *src, size_t n) {
+	char *d = dest;
+	const char *s = src;
+
+	while(n--)
+		*d++ = *s++;
+
+	return dest;
+}
+
+void *memset(void *dest, int c, size_t n) {
+	char *d = dest;
+
+	while(n--)
+		*d++ = c;
+
+	return dest;
+}
+
+size_t strlen(const char *s) {
+	const char *p = s;
+
+	while(*p)
+		p++;
+
+	return p - s;
+}
@@ -0,0 +1,12 @@
+#ifndef FREESTANDING_H
+#define FREESTANDING_H
+
+#include <stddef.h>
+
+// System calls for the runtime when it is built without a C library; they
+// return -errno on failure, like the kernel does
+long sys_write(int, const void *, size_t);
+void sys_exit(int);
+
+#endif
+
@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "runtime/parallel.h"
+#include "runtime/print.h"
+
+#define PARALLEL_THREADS_MAX 64
+
+// Chunked loops are split into this many chunks per thread, so that a thread
+// which finishes early can take over work from a slow one
+#define PARALLEL_CHUNKS 8
+
+typedef void parallel_body_t(int64_t, int64_t, int64_t *);
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER; // A loop has started
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER; // A worker has finished
+
+static int nthreads = 0; // Including the caller, once the pool is started
+static unsigned long generation = 0; // Loops started so far
+static int running = 0; // Workers still busy with the current loop
+static bool busy = false; // A loop is running
+
+// The loop being run
+static parallel_body_t *body;
+static int64_t lo, hi;
+static int64_t *env;
+static bool chunked;
+static int64_t chunk;
+static volatile int64_t next; // Start of the next chunk to hand out
+
+// Runs the thread's share of the current loop
+static void parallel_run(int index) {
+	int64_t a, b, n, each, extra;
+
+	if(chunked) {
+		while((a = __sync_fetch_and_add(&next,chunk)) < hi) {
+			b = hi - a > chunk ? a + chunk : hi;
+			body(a,b,env);
+		}
+		return;
+	}
+
+	// The first few threads take one more iteration each
+	n = hi - lo;
+	each = n/nthreads;
+	extra = n%nthreads;
+	a = lo + index*each + (index < extra ? index : extra);
+	b = a + each + (index < extra);
+
+	if(a < b)
+		body(a,b,env);
+}
+
+static void *parallel_worker(void *arg) {
+	int index = (intptr_t) arg;
+	unsigned long seen = 0;
+
+	for(;;) {
+		pthread_mutex_lock(&lock);
+		while(generation == seen)
+			pthread_cond_wait(&wake,&lock);
+		seen = generation;
+		pthread_mutex_unlock(&lock);
+
+		parallel_run(index);
+
+		pthread_mutex_lock(&lock);
+		if(!--running)
+			pthread_cond_signal(&done);
+		pthread_mutex_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+// Starts the pool; called with the lock held
+static void parallel_start(void) {
+	pthread_attr_t attr;
+	pthread_t thread;
+	char *threads;
+	long n;
+
+	if((threads = getenv("CMINOR_THREADS")))
+		n = strtol(threads,NULL,10);
+	else n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(n < 1)
+		n = 1;
+	if(n > PARALLEL_THREADS_MAX)
+		n = PARALLEL_THREADS_MAX;
+
+	// Functions called from the loop bodies may print
+	print_share();
+
+	// The workers wait for the next loop forever, so nothing joins them
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+
+	// Make do with however many threads can be had
+	for(nthreads = 1; nthreads < n; nthreads++)
+		if(pthread_create(&thread,&attr,parallel_worker,
+			(void *) (intptr_t) nthreads))
+			break;
+
+	pthread_attr_destroy(&attr);
+}
+
+void parallel_for(parallel_body_t *loopbody, int64_t looplo, int64_t loophi,
+	int64_t *loopenv, int64_t loopchunked) {
+	if(looplo >= loophi)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	if(!nthreads)
+		parallel_start();
+
+	// A parallel for reached from inside another's body just runs in the
+	// thread it was reached from
+	if(busy || nthreads == 1 || loophi - looplo < 2) {
+		pthread_mutex_unlock(&lock);
+		loopbody(looplo,loophi,loopenv);
+		return;
+	}
+
+	busy = true;
+	body = loopbody;
+	lo = looplo;
+	hi = loophi;
+	env = loopenv;
+	chunked = loopchunked;
+	chunk = (hi - lo)/(PARALLEL_CHUNKS*nthreads);
+	if(chunk < 1)
+		chunk = 1;
+	next = lo;
+
+	running = nthreads - 1;
+	generation++;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+
+	parallel_run(0);
+
+	pthread_mutex_lock(&lock);
+	while(running)
+		pthread_cond_wait(&done,&lock);
+	busy = false;
+	pthread_mutex_unlock(&lock);
+}
+
@@ -0,0 +1,17 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+
+// Called by the code generated for parallel fors: runs body(a, b, env) over
+// pieces [a, b) which together cover [lo, hi), on a pool of threads started
+// the first time it is needed; chunked hands the pieces out a few at a time,
+// for iterations which may take very different amounts of time, rather than
+// splitting the range evenly up front. The pool has as many threads as there
+// are processors online, or as many as the CMINOR_THREADS environment
+// variable asks for
+void parallel_for(void (*body)(int64_t, int64_t, int64_t *), int64_t lo,
+	int64_t hi, int64_t *env, int64_t chunked);
+
+#endif
+
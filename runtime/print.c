@@ -0,0 +1,181 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef CMINOR_FREESTANDING
+#include "runtime/freestanding.h"
+#else
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include "runtime/print.h"
+
+#define PRINT_BUFFER_SIZE (1 << 16)
+
+static char buffer[PRINT_BUFFER_SIZE];
+static size_t buffered = 0;
+
+#ifndef CMINOR_FREESTANDING
+static bool registered = false;
+
+static pthread_mutex_t lock;
+static bool shared = false; // Other threads may be printing too
+#endif
+
+// Every pair of decimal digits, for converting integers two digits at a time
+static const char digitpairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Writes out len bytes at p, retrying after partial writes and interruptions
+static void print_write(const char *p, size_t len) {
+	long n;
+
+	while(len) {
+#ifdef CMINOR_FREESTANDING
+		if(n = sys_write(1,p,len), n < 0) {
+			if(n == -EINTR)
+				continue;
+#else
+		if(n = write(STDOUT_FILENO,p,len), n < 0) {
+			if(errno == EINTR)
+				continue;
+#endif
+
+			return; // Nowhere to report it
+		}
+
+		p += n;
+		len -= n;
+	}
+}
+
+void print_share(void) {
+#ifndef CMINOR_FREESTANDING
+	pthread_mutexattr_t attr;
+
+	if(shared)
+		return;
+
+	// The routines lock it again when called between print_lock() and
+	// print_unlock()
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lock,&attr);
+	pthread_mutexattr_destroy(&attr);
+
+	shared = true;
+#endif
+}
+
+void print_lock(void) {
+#ifndef CMINOR_FREESTANDING
+	if(shared)
+		pthread_mutex_lock(&lock);
+#endif
+}
+
+void print_unlock(void) {
+#ifndef CMINOR_FREESTANDING
+	if(shared)
+		pthread_mutex_unlock(&lock);
+#endif
+}
+
+void print_flush(void) {
+	print_lock();
+	print_write(buffer,buffered);
+	buffered = 0;
+	print_unlock();
+}
+
+// Makes sure there is room for len more bytes in the buffer
+static void print_reserve(size_t len) {
+#ifndef CMINOR_FREESTANDING // The startup code flushes it instead
+	if(!registered) {
+		atexit(print_flush);
+		registered = true;
+	}
+#endif
+
+	if(buffered + len > sizeof buffer)
+		print_flush();
+}
+
+// Appends len bytes, bypassing the buffer for anything too big for it
+static void print_append(const char *p, size_t len) {
+	print_reserve(len);
+
+	if(len > sizeof buffer) {
+		print_write(p,len);
+		return;
+	}
+
+	memcpy(buffer + buffered,p,len);
+	buffered += len;
+}
+
+void print_boolean(int64_t b) {
+	print_lock();
+
+	if(b)
+		print_append("true",4);
+	else print_append("false",5);
+
+	print_unlock();
+}
+
+void print_character(int64_t c) {
+	print_lock();
+	print_reserve(1);
+	buffer[buffered++] = c;
+	print_unlock();
+}
+
+void print_integer(int64_t i) {
+	char digits[20], *p;
+	uint64_t u;
+	unsigned pair;
+
+	print_lock();
+	print_reserve(sizeof digits + 1);
+
+	if(i < 0) {
+		buffer[buffered++] = '-';
+		u = -(uint64_t) i;
+	} else u = i;
+
+	// Fill in the digits from the right
+	for(p = digits + sizeof digits; u >= 100; u /= 100) {
+		pair = 2*(u%100);
+		*--p = digitpairs[pair + 1];
+		*--p = digitpairs[pair];
+	}
+
+	if(u >= 10) {
+		*--p = digitpairs[2*u + 1];
+		*--p = digitpairs[2*u];
+	} else *--p = '0' + u;
+
+	memcpy(buffer + buffered,p,digits + sizeof digits - p);
+	buffered += digits + sizeof digits - p;
+
+	print_unlock();
+}
+
+void print_string(const char *s) {
+	print_lock();
+	print_append(s,strlen(s));
+	print_unlock();
+}
@@ -0,0 +1,26 @@
+#ifndef PRINT_H
+#define PRINT_H
+
+#include <stdint.h>
+
+// The routines called by the code generated for print statements; output
+// is buffered until the buffer fills up, print_flush() is called, or the
+// program exits
+void print_boolean(int64_t);
+void print_character(int64_t);
+void print_integer(int64_t);
+void print_string(const char *);
+
+void print_flush(void);
+
+// Each print routine prints without output from other threads getting in
+// between, as does each run of them between print_lock() and print_unlock(),
+// once print_share() has been called; the thread pool calls it before
+// starting any other threads. Without a C library there are no threads, and
+// these do nothing
+void print_share(void);
+void print_lock(void);
+void print_unlock(void);
+
+#endif
+
@@ -0,0 +1,242 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arg.h"
+#include "builtin.h"
+#include "str.h"
+#include "symbol.h"
+#include "type.h"
+
+// Functions every program can call without declaring them, unless it declares
+// something of the same name itself; each works on the elements [lo, hi) of
+// integer arrays, and is a routine emitted along with the program if it is
+// used. The minimum and maximum of an empty range are the largest and
+// smallest integers, respectively
+static struct {
+	char *name;
+	char *label;
+	bool returns; // An integer, rather than nothing
+	char *args[4]; // The arrays come first, then the integers
+	size_t arrays;
+
+	char *code;
+	char *cmov; // For the extremums, which go on to share the same body
+
+	symbol_t *symbol;
+	bool used;
+} builtins[] = {
+	// Sets the elements to v, 32 bytes at a time
+	{"array_fill", "array_fill$sse2", false, {"a", "lo", "hi", "v"}, 1,
+		"\tlea (%rdi,%rsi,8), %rax\n"
+		"\tlea (%rdi,%rdx,8), %rdx\n"
+		"\tmovq %rcx, %xmm0\n"
+		"\tpunpcklqdq %xmm0, %xmm0\n"
+		"\tlea -32(%rdx), %rsi\n"
+		"\tcmp %rsi, %rax\n"
+		"\tja 2f\n"
+		"1:\n"
+		"\tmovdqu %xmm0, (%rax)\n"
+		"\tmovdqu %xmm0, 16(%rax)\n"
+		"\tadd $32, %rax\n"
+		"\tcmp %rsi, %rax\n"
+		"\tjbe 1b\n"
+		"2:\n"
+		"\tcmp %rdx, %rax\n"
+		"\tjae 3f\n"
+		"\tmov %rcx, (%rax)\n"
+		"\tadd $8, %rax\n"
+		"\tjmp 2b\n"
+		"3:\n"
+		"\tret\n"},
+
+	// Copies the elements of src into the same places in dst, 32 bytes at
+	// a time; two arrays can only overlap if they are the same one, in
+	// which case nothing changes
+	{"array_copy", "array_copy$sse2", false, {"dst", "src", "lo", "hi"}, 2,
+		"\tlea (%rdi,%rdx,8), %rax\n"
+		"\tlea (%rsi,%rdx,8), %rsi\n"
+		"\tlea (%rdi,%rcx,8), %rdx\n"
+		"\tlea -32(%rdx), %rcx\n"
+		"\tcmp %rcx, %rax\n"
+		"\tja 2f\n"
+		"1:\n"
+		"\tmovdqu (%rsi), %xmm0\n"
+		"\tmovdqu 16(%rsi), %xmm1\n"
+		"\tmovdqu %xmm0, (%rax)\n"
+		"\tmovdqu %xmm1, 16(%rax)\n"
+		"\tadd $32, %rax\n"
+		"\tadd $32, %rsi\n"
+		"\tcmp %rcx, %rax\n"
+		"\tjbe 1b\n"
+		"2:\n"
+		"\tcmp %rdx, %rax\n"
+		"\tjae 3f\n"
+		"\tmov (%rsi), %rcx\n"
+		"\tmov %rcx, (%rax)\n"
+		"\tadd $8, %rax\n"
+		"\tadd $8, %rsi\n"
+		"\tjmp 2b\n"
+		"3:\n"
+		"\tret\n"},
+
+	// Adds up the elements in two vectors of two partial sums each
+	{"array_sum", "array_sum$sse2", true, {"a", "lo", "hi"}, 1,
+		"\tlea (%rdi,%rsi,8), %rax\n"
+		"\tlea (%rdi,%rdx,8), %rdx\n"
+		"\tpxor %xmm0, %xmm0\n"
+		"\tpxor %xmm1, %xmm1\n"
+		"\tlea -32(%rdx), %rcx\n"
+		"\tcmp %rcx, %rax\n"
+		"\tja 2f\n"
+		"1:\n"
+		"\tmovdqu (%rax), %xmm2\n"
+		"\tmovdqu 16(%rax), %xmm3\n"
+		"\tpaddq %xmm2, %xmm0\n"
+		"\tpaddq %xmm3, %xmm1\n"
+		"\tadd $32, %rax\n"
+		"\tcmp %rcx, %rax\n"
+		"\tjbe 1b\n"
+		"2:\n"
+		"\tpaddq %xmm1, %xmm0\n"
+		"\tpshufd $0x4e, %xmm0, %xmm1\n"
+		"\tpaddq %xmm1, %xmm0\n"
+		"\tmovq %xmm0, %rcx\n"
+		"3:\n"
+		"\tcmp %rdx, %rax\n"
+		"\tjae 4f\n"
+		"\tadd (%rax), %rcx\n"
+		"\tadd $8, %rax\n"
+		"\tjmp 3b\n"
+		"4:\n"
+		"\tmov %rcx, %rax\n"
+		"\tret\n"},
+
+	// SSE2 cannot compare 64-bit integers, so these keep four running
+	// minimums (or maximums) in registers instead, which at least do not
+	// wait on each other
+	{"array_min", "array_min$cmov", true, {"a", "lo", "hi"}, 1,
+		"\tmovabs $0x7fffffffffffffff, %rax\n", "cmovg"},
+	{"array_max", "array_max$cmov", true, {"a", "lo", "hi"}, 1,
+		"\tmovabs $0x8000000000000000, %rax\n", "cmovl"}
+};
+
+#define BUILTIN_COUNT (sizeof builtins/sizeof *builtins)
+
+// The body shared by array_min and array_max, with their cmov in place of
+// CMOV
+static const char *extremum =
+	"\tmov %rax, %rcx\n"
+	"\tmov %rax, %r8\n"
+	"\tmov %rax, %r9\n"
+	"\tlea (%rdi,%rsi,8), %rsi\n"
+	"\tlea (%rdi,%rdx,8), %rdx\n"
+	"\tlea -32(%rdx), %rdi\n"
+	"\tcmp %rdi, %rsi\n"
+	"\tja 2f\n"
+	"1:\n"
+	"\tmov (%rsi), %r10\n"
+	"\tmov 8(%rsi), %r11\n"
+	"\tcmp %r10, %rax\n"
+	"\tCMOV %r10, %rax\n"
+	"\tcmp %r11, %rcx\n"
+	"\tCMOV %r11, %rcx\n"
+	"\tmov 16(%rsi), %r10\n"
+	"\tmov 24(%rsi), %r11\n"
+	"\tcmp %r10, %r8\n"
+	"\tCMOV %r10, %r8\n"
+	"\tcmp %r11, %r9\n"
+	"\tCMOV %r11, %r9\n"
+	"\tadd $32, %rsi\n"
+	"\tcmp %rdi, %rsi\n"
+	"\tjbe 1b\n"
+	"2:\n"
+	"\tcmp %rdx, %rsi\n"
+	"\tjae 3f\n"
+	"\tmov (%rsi), %r10\n"
+	"\tcmp %r10, %rax\n"
+	"\tCMOV %r10, %rax\n"
+	"\tadd $8, %rsi\n"
+	"\tjmp 2b\n"
+	"3:\n"
+	"\tcmp %rcx, %rax\n"
+	"\tCMOV %rcx, %rax\n"
+	"\tcmp %r8, %rax\n"
+	"\tCMOV %r8, %rax\n"
+	"\tcmp %r9, %rax\n"
+	"\tCMOV %r9, %rax\n"
+	"\tret\n";
+
+static type_t *builtin_type(size_t i) {
+	type_t *integer;
+	arg_t *args = NULL, **tail = &args;
+
+	integer = type_create(TYPE_INTEGER,0,NULL,NULL,false);
+
+	for(size_t a = 0; a < 4 && builtins[i].args[a]; a++) {
+		*tail = arg_create(str_new(builtins[i].args[a],
+			strlen(builtins[i].args[a])),a < builtins[i].arrays
+			? type_create(TYPE_ARRAY,0,NULL,integer,false)
+			: integer);
+		tail = &(*tail)->next;
+	}
+
+	return type_create(TYPE_FUNCTION,0,args,builtins[i].returns ? integer
+		: type_create(TYPE_VOID,0,NULL,NULL,false),false);
+}
+
+// Returns the symbol for the built-in function of the given name, or NULL
+symbol_t *builtin_lookup(str_t name) {
+	for(size_t i = 0; i < BUILTIN_COUNT; i++) {
+		if(strcmp(name.v,builtins[i].name) != 0)
+			continue;
+
+		if(!builtins[i].symbol)
+			builtins[i].symbol = symbol_create(name,builtin_type(i),
+				SYMBOL_GLOBAL,true,NULL);
+
+		return builtins[i].symbol;
+	}
+
+	return NULL;
+}
+
+bool builtin_is(symbol_t *symbol) {
+	for(size_t i = 0; i < BUILTIN_COUNT; i++)
+		if(symbol && builtins[i].symbol == symbol)
+			return true;
+
+	return false;
+}
+
+// Returns the routine a call to the built-in goes to
+char *builtin_codegen_label(symbol_t *symbol) {
+	for(size_t i = 0; i < BUILTIN_COUNT; i++)
+		if(builtins[i].symbol == symbol) {
+			builtins[i].used = true;
+			return builtins[i].label;
+		}
+
+	return NULL;
+}
+
+// Emits the routines for the built-ins the program calls
+void builtin_print_asm_runtime(FILE *f) {
+	for(size_t i = 0; i < BUILTIN_COUNT; i++) {
+		if(!builtins[i].used)
+			continue;
+
+		fprintf(f,"\t.text\n%s:\n",builtins[i].label);
+		fputs(builtins[i].code,f);
+
+		if(!builtins[i].cmov)
+			continue;
+
+		for(const char *p = extremum; *p; p++)
+			if(strncmp(p,"CMOV",4) == 0) {
+				fputs(builtins[i].cmov,f);
+				p += 3;
+			} else fputc(*p,f);
+	}
+}
+
@@ -0,0 +1,17 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "str.h"
+#include "symbol.h"
+
+symbol_t *builtin_lookup(str_t);
+bool builtin_is(symbol_t *);
+
+char *builtin_codegen_label(symbol_t *);
+void builtin_print_asm_runtime(FILE *);
+
+#endif
+
@@ -16,12 +16,41 @@ static vector_t(str_t) files;
 
 int cminor_errorcount = 0;
 
+bool cminor_cmov = true;
+bool cminor_evaluate = true;
+bool cminor_freestanding = false;
+bool cminor_loop_nest = true;
+bool cminor_memoize = false;
+bool cminor_parallel = true;
+bool cminor_schedule = true;
+bool cminor_promote = true;
+bool cminor_specialize = true;
+bool cminor_whole_program = false;
+
 static void process_args(int argc, char **argv) {
 	for(int i = 1; i < argc; i++) {
 		if(strcmp(argv[i],"-codegen") == 0)
 			cminor_mode = CMINOR_CODEGEN;
 		else if(strcmp(argv[i],"-compile") == 0)
 			cminor_mode = CMINOR_CODEGEN;
+		else if(strcmp(argv[i],"-freestanding") == 0)
+			cminor_freestanding = true;
+		else if(strcmp(argv[i],"-memoize") == 0)
+			cminor_memoize = true;
+		else if(strcmp(argv[i],"-no-cmov") == 0)
+			cminor_cmov = false;
+		else if(strcmp(argv[i],"-no-evaluate") == 0)
+			cminor_evaluate = false;
+		else if(strcmp(argv[i],"-no-loop-nest") == 0)
+			cminor_loop_nest = false;
+		else if(strcmp(argv[i],"-no-parallel") == 0)
+			cminor_parallel = false;
+		else if(strcmp(argv[i],"-no-promote") == 0)
+			cminor_promote = false;
+		else if(strcmp(argv[i],"-no-schedule") == 0)
+			cminor_schedule = false;
+		else if(strcmp(argv[i],"-no-specialize") == 0)
+			cminor_specialize = false;
 		else if(strcmp(argv[i],"-parse") == 0)
 			cminor_mode = CMINOR_PARSE;
 		else if(strcmp(argv[i],"-print") == 0)
@@ -32,6 +61,8 @@ static void process_args(int argc, char **argv) {
 			cminor_mode = CMINOR_SCAN;
 		else if(strcmp(argv[i],"-typecheck") == 0)
 			cminor_mode = CMINOR_TYPECHECK;
+		else if(strcmp(argv[i],"-whole-program") == 0)
+			cminor_whole_program = true;
 		else vector_append(files,str_new(argv[i],strlen(argv[i])));
 	}
 }
@@ -1,6 +1,8 @@
 #ifndef CMINOR_H
 #define CMINOR_H
 
+#include <stdbool.h>
+
 enum {
 	CMINOR_NONE,
 	CMINOR_CODEGEN,
@@ -12,5 +14,16 @@ enum {
 
 extern int cminor_errorcount;
 
+extern bool cminor_cmov; // Replace simple branches with conditional moves
+extern bool cminor_evaluate; // Evaluate calls to pure functions when compiling
+extern bool cminor_freestanding; // No C library will be linked in
+extern bool cminor_loop_nest; // Interchange and tile nests of loops
+extern bool cminor_memoize; // Cache the results of pure functions
+extern bool cminor_parallel; // Run parallel fors on a pool of threads
+extern bool cminor_promote; // Keep globals in registers within functions
+extern bool cminor_schedule; // Reorder instructions within basic blocks
+extern bool cminor_specialize; // Clone functions for constant arguments
+extern bool cminor_whole_program; // Nothing else will be linked against it
+
 #endif
 
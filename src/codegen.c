@@ -1,11 +1,54 @@
+#include "builtin.h"
+#include "cminor.h"
 #include "codegen.h"
 #include "decl.h"
+#include "eval.h"
 #include "expr.h"
+#include "fold.h"
+#include "memo.h"
+#include "outline.h"
+#include "promote.h"
+#include "reach.h"
+#include "spec.h"
+#include "stmt.h"
 
 #include "gen/parse.tab.h"
 
 void codegen(FILE *f) {
+	// Calls folded into constants may leave whole functions unused, and
+	// give everything after more constants to work with
+	if(cminor_evaluate)
+		eval_calls(parse_ast);
+
+	// Only in the whole program can a global be known never to change;
+	// folding those first gives specialization more constants to work with
+	if(cminor_whole_program) {
+		parse_ast = reach_prune(parse_ast);
+		fold_globals(parse_ast);
+	}
+
+	if(cminor_specialize)
+		spec_specialize(parse_ast);
+
+	// Specialization and folding may leave functions and globals unused
+	if(cminor_whole_program)
+		parse_ast = reach_prune(parse_ast);
+
+	if(cminor_memoize)
+		memo_analyze(parse_ast);
+
+	// Without a C library there are no threads to run them on
+	if(cminor_parallel && !cminor_freestanding)
+		outline_loops(parse_ast);
+
+	if(cminor_promote)
+		promote_analyze(parse_ast);
+
 	decl_codegen(parse_ast,f);
+	expr_print_asm_runtime(f);
+	stmt_print_asm_runtime(f);
+	builtin_print_asm_runtime(f);
+	expr_print_asm_templates(f);
 	expr_print_asm_strings(f);
 }
 
@@ -1,10 +1,17 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "arg.h"
 #include "cminor.h"
 #include "decl.h"
+#include "eval.h"
 #include "expr.h"
+#include "layout.h"
+#include "loop.h"
+#include "memo.h"
+#include "outline.h"
 #include "pp_util.h"
+#include "promote.h"
 #include "reg.h"
 #include "scope.h"
 #include "stmt.h"
@@ -12,6 +19,10 @@
 #include "type.h"
 #include "util.h"
 
+static reg_real_t calleesaved[] = {
+	REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
 decl_t *decl_create(str_t name, type_t *type, expr_t *value, stmt_t *body) {
 	return new(decl_t,{
 		.name = name,
@@ -22,9 +33,51 @@ decl_t *decl_create(str_t name, type_t *type, expr_t *value, stmt_t *body) {
 	});
 }
 
+// Returns whether some declaration in the list defines the function
+static bool decl_is_defined(decl_t *this, symbol_t *symbol) {
+	for(; this; this = this->next)
+		if(this->symbol == symbol && this->body)
+			return true;
+
+	return false;
+}
+
+// Puts the return value (if any) in RAX and the callee-saved registers back,
+// all at once
+void decl_codegen_return(decl_t *func, int reg, FILE *f) {
+	int regs[6];
+	reg_real_t reals[6];
+	int value;
+
+	// A variable kept in memory, such as a global, is copied out first;
+	// loaded into RAX as it is, it would be taken for a register from then on
+	value = reg;
+	if(value >= 0 && reg_is_persistent(value) && !reg_is_real(value))
+		reg_make_temporary(&value,f);
+
+	regs[0] = value;
+	reals[0] = REG_RAX;
+
+	for(int i = 0; i < 5; i++) {
+		regs[i + 1] = func->saved[i];
+		reals[i + 1] = calleesaved[i];
+	}
+
+	reg_map_v(6,regs,reals,f);
+
+	if(value != reg)
+		reg_free(value);
+}
+
 void decl_codegen(decl_t *this, FILE *f) {
+	decl_t *head = this;
 	arg_t *arg;
-	int argi, reg, *regs;
+	bool zero;
+	FILE *body;
+	char *text;
+	expr_t *value;
+	size_t pad, textlen;
+	int argi, reg;
 	reg_real_t *realregs;
 
 	while(this) {
@@ -32,13 +85,22 @@ void decl_codegen(decl_t *this, FILE *f) {
 			reg_reset();
 
 			fputs("\t.text\n",f);
-			fprintf(f,"\t.globl %s\n",this->name.v);
-			fprintf(f,"%s:\n",this->name.v);
+			if(!this->local)
+				fprintf(f,"\t.globl %s\n",this->name.v);
+			if(cminor_promote)
+				promote_select(this,f);
+			if(this->memoize)
+				memo_codegen_entry(this,f);
+			else fprintf(f,"%s:\n",this->name.v);
 
-			fputs("\tpush %rbp\n",f);
-			fputs("\tmov %rsp, %rbp\n",f);
+			// Buffer the body so its blocks can be laid out
+			if(body = open_memstream(&text,&textlen), !body)
+				die("cannot buffer code for %s",this->name.v);
 
-			fprintf(f,"\tsub $%s$spill, %%rsp\n",this->name.v);
+			fputs("\tpush %rbp\n",body);
+			fputs("\tmov %rsp, %rbp\n",body);
+
+			fprintf(body,"\tsub $%s$spill, %%rsp\n",this->name.v);
 
 			// Assign the arguments to virtual registers
 			realregs = (reg_real_t []) {
@@ -56,38 +118,69 @@ void decl_codegen(decl_t *this, FILE *f) {
 					arg->symbol->reg,&arg->symbol->reg);
 			}
 
-			// Preserve the callee-saved registers
-			regs = (int []) {
-				reg_assign_real(REG_RBX),
-				reg_assign_real(REG_R12),
-				reg_assign_real(REG_R13),
-				reg_assign_real(REG_R14),
-				reg_assign_real(REG_R15)
-			};
+			// Preserve the callee-saved registers; like locals, they
+			// are kept in the same place on every path
+			for(int i = 0; i < 5; i++) {
+				this->saved[i] = reg_assign_real(calleesaved[i]);
+				reg_set_lvalue(this->saved[i],this->saved + i);
+			}
+
+			if(cminor_loop_nest)
+				loop_nest_optimize(this);
+
+			promote_codegen_enter(body);
+			outline_codegen_enter(this,body);
 
-			stmt_codegen(this->body,f);
-			fputs("99:\n",f);
+			stmt_codegen(this->body,body,this);
 
-			// Restore the callee-saved registers
-			reg_map_v(5,regs,(reg_real_t []) {
-				REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15
-			},f);
+			// Falling off the end returns nothing in particular
+			outline_codegen_leave(this,body);
+			promote_codegen_store(NULL,body);
+			decl_codegen_return(this,-1,body);
+			fprintf(body,".L%s$return:\n",this->name.v);
 
-			fputs("\tmov %rbp, %rsp\n",f);
-			fputs("\tpop %rbp\n",f);
-			fputs("\tret\n",f);
+			fputs("\tmov %rbp, %rsp\n",body);
+			fputs("\tpop %rbp\n",body);
+			fputs("\tret\n",body);
+
+			promote_codegen_leave();
+
+			fclose(body);
+			layout_function(text,f);
+			free(text);
 
 			fprintf(f,"\t.set %s$spill, %zu\n",
 				this->name.v,8*reg_frame_size());
-		} else if(!type_is(this->type,TYPE_FUNCTION)
-			&& this->symbol->level == SYMBOL_GLOBAL) {
-			fprintf(f,"\t.data\n.globl %s\n%s: ",this->name.v,
-				this->name.v);
 
-			if(this->value)
-				expr_print_asm(expr_eval_constant(this->value),
-					f,true);
-			else fprintf(f,".space %zu\n",8*type_size(this->type));
+			if(this->memoize)
+				memo_codegen_cache(this,f);
+		} else if(type_is(this->type,TYPE_FUNCTION)) {
+			// Without a C library, nothing else could define it
+			if(cminor_freestanding
+				&& !decl_is_defined(head,this->symbol))
+				error("%s is never defined, and no C library is "
+					"linked in freestanding mode",this->name.v);
+		} else if(this->symbol->level == SYMBOL_GLOBAL) {
+			value = this->value
+				? expr_eval_constant(this->value) : NULL;
+			zero = !value || expr_is_zero(value);
+
+			// All-zero globals take up no space in the executable
+			fprintf(f,"\t%s\n",
+				this->readonly ? ".section .rodata\n\t.p2align 3"
+				: zero ? ".bss\n\t.p2align 3" : ".data");
+			if(!this->local)
+				fprintf(f,".globl %s\n",this->name.v);
+			fprintf(f,"%s: ",this->name.v);
+
+			// Packed arrays are padded out to a whole word
+			if(!zero) {
+				expr_print_asm(value,f,true);
+				pad = 8*type_size(this->type)
+					- type_bytes(this->type);
+				if(type_is(this->type,TYPE_ARRAY) && pad)
+					fprintf(f,"\n\t.space %zu",pad);
+			} else fprintf(f,".space %zu\n",8*type_size(this->type));
 
 			fputc('\n',f);
 		} else if(this->value) {
@@ -98,8 +191,11 @@ void decl_codegen(decl_t *this, FILE *f) {
 
 			reg = expr_codegen(
 				this->value,f,false,this->symbol->reg);
-			if(this->symbol->reg < 0)
+			if(this->symbol->reg < 0) {
+				// The value may be a constant or another name
+				reg_make_temporary(&reg,f);
 				this->symbol->reg = reg;
+			}
 
 			reg_make_persistent(this->symbol->reg);
 			reg_set_lvalue(
@@ -193,7 +289,31 @@ void decl_resolve(decl_t *this) {
 	}
 }
 
+// Replaces the initializer of the global with the literal it evaluates to,
+// if it can be evaluated at compile time
+static void decl_typecheck_global(decl_t *head, decl_t *this, int errors) {
+	expr_t *value;
+	char *why = NULL;
+
+	if(!errors && (value = eval_global(head,this,&why))) {
+		this->value = value;
+		return;
+	}
+
+	cminor_errorcount++;
+	printf("type error: global variable (%s) cannot be initialized with "
+		"non-constant expression (",this->name.v);
+	expr_print(this->value);
+	if(why)
+		printf("), which cannot be evaluated at compile time because "
+			"%s\n",why);
+	else printf(")\n");
+}
+
 void decl_typecheck(decl_t *this) {
+	decl_t *head = this;
+	int errors;
+
 	while(this) {
 		// Variable initialization
 		if(this->value) {
@@ -208,15 +328,6 @@ void decl_typecheck(decl_t *this) {
 				printf(" (");
 				expr_print(this->value);
 				printf(")\n");
-			} else if(this->symbol->level == SYMBOL_GLOBAL
-				&& !this->value->type->constant) {
-				cminor_errorcount++;
-				printf("type error: global variable (%s) "
-					"cannot be initialized with "
-					"non-constant expression (",
-					this->name.v);
-				expr_print(this->value);
-				printf(")\n");
 			}
 		}
 
@@ -226,5 +337,14 @@ void decl_typecheck(decl_t *this) {
 
 		this = this->next;
 	}
+
+	// Calls in the initializers of globals can only be evaluated once
+	// every function they might reach has been checked
+	errors = cminor_errorcount;
+	for(this = head; this; this = this->next)
+		if(this->value && this->symbol->level == SYMBOL_GLOBAL
+			&& !this->value->type->constant
+			&& type_eq(this->type,this->value->type))
+			decl_typecheck_global(head,this,errors);
 }
 
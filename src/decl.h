@@ -1,6 +1,7 @@
 #ifndef DECL_H
 #define DECL_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "str.h"
@@ -13,12 +14,18 @@ typedef struct decl {
 
 	struct symbol *symbol;
 
+	int saved[5]; // Virtual registers holding the callee-saved registers
+	bool memoize; // Calls go through a cache of results
+	bool local; // Nothing outside the program refers to it
+	bool readonly; // Nothing ever changes it
+
 	struct decl *next;
 } decl_t;
 
 decl_t *decl_create(str_t, struct type *, struct expr *, struct stmt *);
 
 void decl_codegen(decl_t *, FILE *);
+void decl_codegen_return(decl_t *, int, FILE *);
 void decl_print(decl_t *, int);
 void decl_resolve(decl_t *);
 void decl_typecheck(decl_t *);
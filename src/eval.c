@@ -0,0 +1,956 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arg.h"
+#include "builtin.h"
+#include "decl.h"
+#include "eval.h"
+#include "expr.h"
+#include "htable.h"
+#include "pp_util.h"
+#include "spec.h"
+#include "stmt.h"
+#include "str.h"
+#include "symbol.h"
+#include "type.h"
+#include "util.h"
+#include "vector.h"
+
+// An evaluation gives up once it has taken this many steps, each a statement
+// or an expression,
+#define EVAL_STEPS_MAX (1 << 24)
+
+// once its frames and arrays hold this many values at once,
+#define EVAL_VALUES_MAX (1 << 20)
+
+// or once its calls nest this deep, so the compiler's own stack lasts
+#define EVAL_DEPTH_MAX 1000
+
+// All the evaluations together take at most this many steps, so that many
+// calls which each use up their own budget cannot stall the compiler
+#define EVAL_TOTAL_STEPS_MAX (1 << 26)
+
+typedef struct eval_value {
+	bool set; // Has been given a value
+	bool readonly; // Is an array which cannot be changed through it
+
+	int64_t i; // Booleans, chars and integers
+	str_t *s; // Strings, which are always literals somewhere in the program
+
+	// Arrays, whose elements (and theirs, for nested arrays) are laid out
+	// one after another
+	struct eval_value *elems;
+	int64_t n;
+} eval_value_t;
+
+typedef enum {
+	EVAL_FAILED,
+	EVAL_NEXT,
+	EVAL_RETURN
+} eval_status_t;
+
+// A function being run
+typedef struct {
+	decl_t *func;
+	eval_value_t *args;
+	eval_value_t *locals; // By index, which sibling blocks share
+
+	// The elements of the local arrays, by index, which are reused each
+	// time the declaration is run again
+	eval_value_t **arrays;
+	size_t *sizes;
+
+	eval_value_t result;
+} eval_frame_t;
+
+// A call made before, and what came of it
+typedef struct {
+	bool ok;
+	eval_value_t value;
+} eval_result_t;
+
+// A global the initializer has read
+typedef struct {
+	symbol_t *symbol;
+	eval_value_t value;
+} eval_global_t;
+
+typedef_htable_t(eval_result_t);
+typedef_vector_t(eval_global_t);
+
+static decl_t *program;
+
+// The global whose initializer is being evaluated, which may read what the
+// other globals start with; without one, the evaluation is of a call in
+// some function, by which time they may have changed
+static decl_t *initializing;
+static vector_t(eval_global_t) globals;
+
+static size_t steps, values, depth;
+static size_t totalsteps; // Taken by every evaluation so far
+static size_t globalreads; // Made so far, which calls cannot be cached past
+
+// The results of calls with only scalar arguments, by callee and arguments;
+// failures are only kept for calls evaluated on their own
+static htable_t(eval_result_t) results;
+
+static char failure[128]; // Why the evaluation gave up
+
+static bool eval_expr(expr_t *, eval_frame_t *, eval_value_t *);
+static eval_status_t eval_stmt(stmt_t *, eval_frame_t *);
+
+// Notes why the evaluation gave up, unless it already has a reason
+static bool eval_fail(char *fmt, ...) {
+	va_list ap;
+
+	if(!*failure) {
+		va_start(ap,fmt);
+		vsnprintf(failure,sizeof failure,fmt,ap);
+		va_end(ap);
+	}
+
+	return false;
+}
+
+static bool eval_step(void) {
+	if(++totalsteps > EVAL_TOTAL_STEPS_MAX)
+		return eval_fail("evaluating the program has already taken "
+			"more than %d steps",EVAL_TOTAL_STEPS_MAX);
+
+	return ++steps <= EVAL_STEPS_MAX
+		|| eval_fail("it takes more than %d steps",EVAL_STEPS_MAX);
+}
+
+// Returns how many values something of the type takes up
+static size_t eval_words(type_t *type) {
+	if(!type_is(type,TYPE_ARRAY))
+		return 1;
+
+	return type->size > 0 ? type->size*eval_words(type->subtype) : 0;
+}
+
+static eval_value_t *eval_alloc(size_t n) {
+	if(n > EVAL_VALUES_MAX - values) {
+		eval_fail("it needs more than %d values at once",
+			EVAL_VALUES_MAX);
+		return NULL;
+	}
+
+	values += n;
+
+	return calloc(n ? n : 1,sizeof(eval_value_t));
+}
+
+static void eval_release(eval_value_t *elems, size_t n) {
+	free(elems);
+	values -= n;
+}
+
+static void eval_begin(void) {
+	steps = values = depth = 0;
+	*failure = '\0';
+	vector_init(globals);
+}
+
+static void eval_end(void) {
+	for(size_t i = 0; i < globals.n; i++)
+		if(globals.v[i].value.elems)
+			eval_release(globals.v[i].value.elems,
+				eval_words(globals.v[i].symbol->type));
+
+	vector_free(globals);
+}
+
+// Evaluates the elements of an array initializer, nested ones included, into
+// the values from elems on; returns where it left off, or NULL
+static eval_value_t *eval_fill(expr_t *this, eval_frame_t *frame,
+	eval_value_t *elems, eval_value_t *end) {
+	eval_value_t value;
+
+	for(; this; this = this->next) {
+		if(this->op == EXPR_ARRAY) {
+			if(!(elems = eval_fill(this->left,frame,elems,end)))
+				return NULL;
+			continue;
+		}
+
+		if(elems == end || !eval_expr(this,frame,&value))
+			return NULL;
+
+		*elems++ = value;
+	}
+
+	return elems;
+}
+
+// Finds what the global starts with, which only an initializer can rely on
+static bool eval_global_value(symbol_t *symbol, eval_value_t *out) {
+	eval_global_t global;
+	type_t *scalar;
+	decl_t *decl;
+	size_t n;
+
+	globalreads++;
+
+	if(!initializing)
+		return eval_fail("it reads the global %s",symbol->name.v);
+
+	for(size_t i = 0; i < globals.n; i++)
+		if(globals.v[i].symbol == symbol) {
+			*out = globals.v[i].value;
+			return true;
+		}
+
+	for(decl = program; decl->symbol != symbol; decl = decl->next);
+
+	// Another initializer still to be evaluated
+	if(decl->value && !decl->value->type->constant)
+		return eval_fail("it reads the global %s before it is "
+			"initialized",symbol->name.v);
+
+	global.symbol = symbol;
+
+	if(!type_is(decl->type,TYPE_ARRAY)) {
+		// Strings start out as null pointers
+		global.value = (eval_value_t) {
+			.set = !type_is(decl->type,TYPE_STRING)
+		};
+
+		if(decl->value && !eval_expr(decl->value,NULL,&global.value))
+			return false;
+	} else {
+		for(scalar = decl->type; type_is(scalar,TYPE_ARRAY);
+			scalar = scalar->subtype);
+
+		n = eval_words(decl->type);
+		global.value = (eval_value_t) {
+			.set = true,
+			.readonly = true,
+			.n = decl->type->size
+		};
+
+		if(!(global.value.elems = eval_alloc(n)))
+			return false;
+
+		for(size_t i = 0; i < n; i++)
+			global.value.elems[i].set
+				= !type_is(scalar,TYPE_STRING);
+
+		if(decl->value && !eval_fill(decl->value->left,NULL,
+			global.value.elems,global.value.elems + n)) {
+			eval_release(global.value.elems,n);
+			return false;
+		}
+	}
+
+	vector_append(globals,global);
+	*out = global.value;
+
+	return true;
+}
+
+// Returns the element of the array at the index, which for nested arrays is
+// the first value of a row, or NULL if it is out of bounds
+static eval_value_t *eval_element(eval_value_t *array, int64_t index,
+	type_t *type) {
+	if(index < 0 || index >= array->n) {
+		eval_fail("it indexes an array out of bounds");
+		return NULL;
+	}
+
+	return array->elems + index*eval_words(type);
+}
+
+// Returns where the value the expression names is kept, or NULL if it may
+// not be changed
+static eval_value_t *eval_lvalue(expr_t *this, eval_frame_t *frame) {
+	eval_value_t array, index;
+
+	if(this->op == EXPR_REFERENCE) {
+		switch(this->symbol->level) {
+		case SYMBOL_ARG:
+			return frame->args + this->symbol->index;
+
+		case SYMBOL_LOCAL:
+			return frame->locals + this->symbol->index;
+
+		case SYMBOL_GLOBAL:
+			globalreads++;
+			eval_fail("it changes the global %s",
+				this->symbol->name.v);
+			return NULL;
+		}
+	}
+
+	// Otherwise, it is a subscript
+	if(!eval_expr(this->left,frame,&array)
+		|| !eval_expr(this->right,frame,&index))
+		return NULL;
+
+	if(array.readonly) {
+		eval_fail("it changes a global array");
+		return NULL;
+	}
+
+	return eval_element(&array,index.i,this->type);
+}
+
+// Raises a to the power b the way the generated code does, wrapping around
+// on overflow
+static int64_t eval_pow(uint64_t a, int64_t b) {
+	uint64_t r = 1;
+
+	if(b <= 0)
+		return b == 0;
+
+	for(; b > 1; b >>= 1) {
+		if(b&1)
+			r *= a;
+		a *= a;
+	}
+
+	return r*a;
+}
+
+// Does what the built-in would, which only ever works on integer arrays
+static bool eval_builtin(symbol_t *symbol, eval_value_t *args,
+	eval_value_t *out) {
+	bool copy, fill, max, min;
+	eval_value_t *a;
+	int64_t lo, hi;
+
+	copy = strcmp(symbol->name.v,"array_copy") == 0;
+	fill = strcmp(symbol->name.v,"array_fill") == 0;
+	max = strcmp(symbol->name.v,"array_max") == 0;
+	min = strcmp(symbol->name.v,"array_min") == 0;
+
+	a = args;
+	lo = args[copy ? 2 : 1].i;
+	hi = args[copy ? 3 : 2].i;
+
+	out->i = min ? INT64_MAX : max ? INT64_MIN : 0;
+
+	if(lo >= hi)
+		return true;
+
+	if(lo < 0 || hi > a->n || copy && hi > args[1].n)
+		return eval_fail("it indexes an array out of bounds");
+
+	if((copy || fill) && a->readonly)
+		return eval_fail("it changes a global array");
+
+	for(int64_t i = lo; i < hi; i++) {
+		if(!eval_step())
+			return false;
+
+		if(copy)
+			a->elems[i] = args[1].elems[i];
+		else if(fill)
+			a->elems[i] = args[3];
+		else if(!a->elems[i].set)
+			return eval_fail("it reads a variable before giving "
+				"it a value");
+		else if(min)
+			out->i = a->elems[i].i < out->i ? a->elems[i].i : out->i;
+		else if(max)
+			out->i = a->elems[i].i > out->i ? a->elems[i].i : out->i;
+		else out->i = (uint64_t) out->i + a->elems[i].i;
+	}
+
+	return true;
+}
+
+// Returns the key the result of the call is remembered under, which is empty
+// if it is passed an array
+static str_t eval_key(decl_t *func, eval_value_t *args, size_t nargs) {
+	str_t key;
+	char *p;
+	size_t n;
+
+	vector_init(key);
+
+	for(p = (char *) &func, n = sizeof func; n--; p++)
+		str_append_c(&key,*p);
+
+	for(size_t i = 0; i < nargs; i++) {
+		if(args[i].elems) {
+			free(key.v);
+			vector_init(key);
+			break;
+		}
+
+		if(args[i].s)
+			p = args[i].s->v, n = args[i].s->n + 1;
+		else p = (char *) &args[i].i, n = sizeof args[i].i;
+
+		while(n--)
+			str_append_c(&key,*p++);
+	}
+
+	return key;
+}
+
+// Runs the function on the arguments
+static bool eval_run(decl_t *func, eval_value_t *args, size_t nargs,
+	eval_value_t *out) {
+	eval_result_t *cached;
+	eval_status_t status;
+	eval_frame_t frame;
+	size_t nlocals, reads;
+	bool ok, outermost;
+	str_t key;
+
+	if(!results.v)
+		results = htable_new(eval_result_t);
+
+	key = eval_key(func,args,nargs);
+	if(key.v && (cached = htable_lookup(results,key))) {
+		free(key.v);
+		*out = cached->value;
+		return cached->ok || eval_fail("it calls %s, which cannot be "
+			"evaluated",func->name.v);
+	}
+
+	if(depth == EVAL_DEPTH_MAX) {
+		free(key.v);
+		return eval_fail("its calls nest more than %d deep",
+			EVAL_DEPTH_MAX);
+	}
+
+	// An array in the result would be left pointing into the frame
+	if(type_is(func->type->subtype,TYPE_ARRAY)) {
+		free(key.v);
+		return eval_fail("%s returns an array",func->name.v);
+	}
+
+	nlocals = func->type->nlocals;
+
+	frame.func = func;
+	frame.args = args;
+	frame.result = (eval_value_t) {.set = false};
+
+	if(!(frame.locals = eval_alloc(nlocals))) {
+		free(key.v);
+		return false;
+	}
+
+	frame.arrays = calloc(nlocals + 1,sizeof *frame.arrays);
+	frame.sizes = calloc(nlocals + 1,sizeof *frame.sizes);
+
+	outermost = !depth++;
+	reads = globalreads;
+
+	status = eval_stmt(func->body,&frame);
+
+	depth--;
+
+	for(size_t i = 0; i < nlocals; i++)
+		if(frame.arrays[i])
+			eval_release(frame.arrays[i],frame.sizes[i]);
+
+	free(frame.arrays);
+	free(frame.sizes);
+	eval_release(frame.locals,nlocals);
+
+	ok = status == EVAL_RETURN || status == EVAL_NEXT
+		&& (type_is(func->type->subtype,TYPE_VOID)
+			|| eval_fail("%s returns no value",func->name.v));
+
+	*out = frame.result;
+
+	// A failure partway through another call may only be for want of
+	// what that call had already used up
+	if(key.v && reads == globalreads
+		&& (ok || outermost && !initializing))
+		htable_insert(results,key,new(eval_result_t,{ok,*out}));
+	else free(key.v);
+
+	return ok;
+}
+
+static bool eval_call(expr_t *this, eval_frame_t *frame, eval_value_t *out) {
+	symbol_t *symbol;
+	decl_t *func;
+	size_t n;
+
+	symbol = this->left->symbol;
+	n = arg_count(this->left->type->args);
+
+	eval_value_t args[n + 1];
+
+	n = 0;
+	for(expr_t *arg = this->right; arg; arg = arg->next)
+		if(!eval_expr(arg,frame,args + n++))
+			return false;
+
+	if(builtin_is(symbol))
+		return eval_builtin(symbol,args,out);
+
+	for(func = program; func; func = func->next)
+		if(func->symbol == symbol && func->body)
+			return eval_run(func,args,n,out);
+
+	return eval_fail("it calls %s, which is not defined in the program",
+		symbol->name.v);
+}
+
+static bool eval_expr(expr_t *this, eval_frame_t *frame, eval_value_t *out) {
+	eval_value_t left, right, *slot;
+	bool string;
+
+	if(!eval_step())
+		return false;
+
+	switch(this->op) {
+	case EXPR_AND:
+	case EXPR_OR:
+		if(!eval_expr(this->left,frame,out))
+			return false;
+
+		// Only as much is evaluated as the generated code would
+		return out->i == (this->op == EXPR_OR)
+			|| eval_expr(this->right,frame,out);
+
+	case EXPR_ASSIGN:
+		if(!(slot = eval_lvalue(this->left,frame))
+			|| !eval_expr(this->right,frame,out))
+			return false;
+
+		*slot = *out;
+		return true;
+
+	case EXPR_CALL:
+		return eval_call(this,frame,out);
+
+	case EXPR_DECREMENT:
+	case EXPR_INCREMENT:
+		if(!(slot = eval_lvalue(this->left,frame)))
+			return false;
+
+		if(!slot->set)
+			return eval_fail("it reads a variable before giving "
+				"it a value");
+
+		*out = *slot;
+		slot->i = (uint64_t) slot->i
+			+ (this->op == EXPR_INCREMENT ? 1 : -1);
+		return true;
+
+	case EXPR_NEGATE:
+	case EXPR_NOT:
+		if(!eval_expr(this->left,frame,out))
+			return false;
+
+		out->i = this->op == EXPR_NOT ? !out->i
+			: (int64_t) -(uint64_t) out->i;
+		return true;
+
+	case EXPR_SUBSCRIPT:
+		if(!eval_expr(this->left,frame,&left)
+			|| !eval_expr(this->right,frame,&right)
+			|| !(slot = eval_element(&left,right.i,this->type)))
+			return false;
+
+		// A row of a nested array is itself an array
+		if(type_is(this->type,TYPE_ARRAY)) {
+			*out = (eval_value_t) {
+				.set = true,
+				.readonly = left.readonly,
+				.elems = slot,
+				.n = this->type->size
+			};
+			return true;
+		}
+
+		*out = *slot;
+		return out->set || eval_fail("it reads a variable before "
+			"giving it a value");
+
+	case EXPR_ARRAY:
+		return eval_fail("it passes an array literal");
+
+	case EXPR_BOOLEAN:
+	case EXPR_CHARACTER:
+	case EXPR_INTEGER:
+	case EXPR_STRING:
+		*out = (eval_value_t) {
+			.set = true,
+			.i = this->op == EXPR_BOOLEAN ? this->b
+				: this->op == EXPR_CHARACTER ? this->c
+				: this->i,
+			.s = this->op == EXPR_STRING ? &this->s : NULL
+		};
+		return true;
+
+	case EXPR_REFERENCE:
+		if(type_is(this->symbol->type,TYPE_FUNCTION))
+			return eval_fail("it uses %s other than by calling it",
+				this->symbol->name.v);
+
+		if(this->symbol->level == SYMBOL_GLOBAL) {
+			if(!eval_global_value(this->symbol,out))
+				return false;
+		} else *out = *eval_lvalue(this,frame);
+
+		return out->set || eval_fail("it reads a variable before "
+			"giving it a value");
+
+	default:
+		break;
+	}
+
+	// The rest read both their operands, and nothing else
+	if(!eval_expr(this->left,frame,&left)
+		|| !eval_expr(this->right,frame,&right))
+		return false;
+
+	*out = (eval_value_t) {.set = true};
+
+	switch(this->op) {
+	case EXPR_ADD:
+		out->i = (uint64_t) left.i + right.i;
+		break;
+
+	case EXPR_DIVIDE:
+	case EXPR_REMAINDER:
+		// Either would trap in idiv
+		if(right.i == 0)
+			return eval_fail("it divides by zero");
+		if(left.i == INT64_MIN && right.i == -1)
+			return eval_fail("it divides the smallest integer by "
+				"-1");
+
+		out->i = this->op == EXPR_DIVIDE ? left.i/right.i
+			: left.i%right.i;
+		break;
+
+	case EXPR_EXPONENT:
+		out->i = eval_pow(left.i,right.i);
+		break;
+
+	case EXPR_MULTIPLY:
+		out->i = (uint64_t) left.i*right.i;
+		break;
+
+	case EXPR_SUBTRACT:
+		out->i = (uint64_t) left.i - right.i;
+		break;
+
+	case EXPR_EQ:
+	case EXPR_NE:
+		string = type_is(this->left->type,TYPE_STRING);
+		out->i = (string ? strcmp(left.s->v,right.s->v) == 0
+			: left.i == right.i) == (this->op == EXPR_EQ);
+		break;
+
+	case EXPR_GE: out->i = left.i >= right.i; break;
+	case EXPR_GT: out->i = left.i > right.i;  break;
+	case EXPR_LE: out->i = left.i <= right.i; break;
+	case EXPR_LT: out->i = left.i < right.i;  break;
+
+	default:
+		die("unexpected operator in eval_expr()");
+	}
+
+	return true;
+}
+
+// Runs the declaration of a local
+static bool eval_decl(decl_t *this, eval_frame_t *frame) {
+	eval_value_t value, *slot;
+	size_t index, n;
+
+	index = this->symbol->index;
+	slot = frame->locals + index;
+
+	if(!type_is(this->type,TYPE_ARRAY)) {
+		// The initializer may read the local itself
+		value = (eval_value_t) {.set = false};
+		if(this->value && !eval_expr(this->value,frame,&value))
+			return false;
+
+		*slot = value;
+		return true;
+	}
+
+	// An empty array shares its index with the next local
+	if(!(n = eval_words(this->type)))
+		return eval_fail("it declares an empty array");
+
+	if(frame->sizes[index] < n) {
+		if(frame->arrays[index])
+			eval_release(frame->arrays[index],frame->sizes[index]);
+		frame->sizes[index] = 0;
+
+		if(!(frame->arrays[index] = eval_alloc(n)))
+			return false;
+		frame->sizes[index] = n;
+	}
+
+	memset(frame->arrays[index],0,n*sizeof(eval_value_t));
+
+	*slot = (eval_value_t) {
+		.set = true,
+		.elems = frame->arrays[index],
+		.n = this->type->size
+	};
+
+	if(!this->value)
+		return true;
+
+	if(this->value->op != EXPR_ARRAY)
+		return eval_fail("it initializes %s from another array",
+			this->name.v);
+
+	return eval_fill(this->value->left,frame,slot->elems,slot->elems + n);
+}
+
+static eval_status_t eval_stmt(stmt_t *this, eval_frame_t *frame) {
+	eval_status_t status;
+	eval_value_t value;
+
+	for(; this; this = this->next) {
+		if(!eval_step())
+			return EVAL_FAILED;
+
+		switch(this->op) {
+		case STMT_BLOCK:
+			if((status = eval_stmt(this->body,frame)) != EVAL_NEXT)
+				return status;
+			break;
+
+		case STMT_DECL:
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(!eval_decl(decl,frame))
+					return EVAL_FAILED;
+			break;
+
+		case STMT_EXPR:
+			if(!eval_expr(this->expr,frame,&value))
+				return EVAL_FAILED;
+			break;
+
+		// A parallel for runs the same way, since its iterations
+		// cannot depend on each other
+		case STMT_FOR:
+			if(this->init_expr
+				&& !eval_expr(this->init_expr,frame,&value))
+				return EVAL_FAILED;
+
+			for(;;) {
+				if(!eval_step())
+					return EVAL_FAILED;
+
+				if(this->expr) {
+					if(!eval_expr(this->expr,frame,&value))
+						return EVAL_FAILED;
+					if(!value.i)
+						break;
+				}
+
+				status = eval_stmt(this->body,frame);
+				if(status != EVAL_NEXT)
+					return status;
+
+				if(this->next_expr
+					&& !eval_expr(this->next_expr,frame,
+						&value))
+					return EVAL_FAILED;
+			}
+			break;
+
+		case STMT_IF_ELSE:
+			if(!eval_expr(this->expr,frame,&value))
+				return EVAL_FAILED;
+
+			status = eval_stmt(value.i ? this->body
+				: this->else_body,frame);
+			if(status != EVAL_NEXT)
+				return status;
+			break;
+
+		case STMT_PRINT:
+			eval_fail("it prints");
+			return EVAL_FAILED;
+
+		case STMT_RETURN:
+			if(this->expr
+				&& !eval_expr(this->expr,frame,&frame->result))
+				return EVAL_FAILED;
+			return EVAL_RETURN;
+		}
+	}
+
+	return EVAL_NEXT;
+}
+
+// Turns the value back into a literal of the type, or returns NULL
+static expr_t *eval_literal(eval_value_t *value, type_t *type) {
+	expr_t *head, **tail;
+	eval_value_t elem;
+	size_t words;
+
+	if(type_is(type,TYPE_ARRAY)) {
+		words = eval_words(type->subtype);
+
+		tail = &head;
+		for(int64_t i = 0; i < type->size; i++) {
+			elem = type_is(type->subtype,TYPE_ARRAY)
+				? (eval_value_t) {
+					.set = true,
+					.elems = value->elems + i*words
+				} : value->elems[i];
+
+			if(!(*tail = eval_literal(&elem,type->subtype)))
+				return NULL;
+			tail = &(*tail)->next;
+		}
+		*tail = NULL;
+
+		return expr_create(EXPR_ARRAY,head,NULL);
+	}
+
+	if(!value->set) {
+		eval_fail("it reads a variable before giving it a value");
+		return NULL;
+	}
+
+	switch(type->type) {
+	case TYPE_BOOLEAN:   return expr_create_boolean(value->i);
+	case TYPE_CHARACTER: return expr_create_character(value->i);
+	case TYPE_INTEGER:   return expr_create_integer(value->i);
+	case TYPE_STRING:    return expr_create_string(*value->s);
+	default:             return NULL;
+	}
+}
+
+// Evaluates the initializer of the global, which may call functions of the
+// program and read what the other globals start with; returns the literal
+// it comes to, or NULL with why pointing to the reason, if there is one
+expr_t *eval_global(decl_t *this, decl_t *global, char **why) {
+	eval_value_t value;
+	expr_t *literal;
+	size_t n;
+
+	program = this;
+	initializing = global;
+	literal = NULL;
+
+	eval_begin();
+
+	if(!type_is(global->type,TYPE_ARRAY)) {
+		if(eval_expr(global->value,NULL,&value))
+			literal = eval_literal(&value,global->type);
+	} else if(global->value->op == EXPR_ARRAY) {
+		n = eval_words(global->type);
+		value = (eval_value_t) {.set = true, .n = global->type->size};
+
+		if((value.elems = eval_alloc(n))) {
+			if(eval_fill(global->value->left,NULL,value.elems,
+				value.elems + n))
+				literal = eval_literal(&value,global->type);
+			eval_release(value.elems,n);
+		}
+	}
+
+	eval_end();
+
+	initializing = NULL;
+	*why = *failure ? failure : NULL;
+
+	if(literal)
+		expr_typecheck(literal);
+
+	return literal;
+}
+
+// Turns the expression into the literal, in place
+static void eval_replace(expr_t *this, expr_t *literal) {
+	this->op = literal->op;
+	this->b = literal->b;
+	this->c = literal->c;
+	this->i = literal->i;
+	this->s = literal->s;
+	this->symbol = NULL;
+	this->type = literal->type;
+	this->effects = literal->effects;
+	this->need = literal->need;
+	this->left = this->right = NULL;
+}
+
+// Replaces the calls with constant arguments by what they return, where that
+// can be worked out; returns how many were
+static size_t eval_fold_expr(expr_t *this) {
+	eval_value_t value;
+	expr_t *literal;
+	size_t folded;
+	bool constant;
+
+	for(folded = 0; this; this = this->next) {
+		folded += eval_fold_expr(this->left);
+		folded += eval_fold_expr(this->right);
+
+		if(this->op != EXPR_CALL || type_is(this->type,TYPE_ARRAY)
+			|| type_is(this->type,TYPE_VOID))
+			continue;
+
+		constant = true;
+		for(expr_t *arg = this->right; arg; arg = arg->next)
+			constant = constant && arg->type->constant;
+
+		if(!constant)
+			continue;
+
+		eval_begin();
+		literal = eval_expr(this,NULL,&value)
+			? eval_literal(&value,this->type) : NULL;
+		eval_end();
+
+		if(!literal)
+			continue;
+
+		expr_typecheck(literal);
+		eval_replace(this,literal);
+		folded++;
+	}
+
+	return folded;
+}
+
+static size_t eval_fold_stmt(stmt_t *this) {
+	size_t folded;
+
+	for(folded = 0; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				folded += eval_fold_expr(decl->value);
+
+		folded += eval_fold_expr(this->init_expr);
+		folded += eval_fold_expr(this->expr);
+		folded += eval_fold_expr(this->next_expr);
+
+		folded += eval_fold_stmt(this->body);
+		folded += eval_fold_stmt(this->else_body);
+	}
+
+	return folded;
+}
+
+// Evaluates the calls with constant arguments to functions which, given
+// those arguments, only compute a result, and folds what they return through
+// the rest of the function; the results of calls are remembered, so each
+// is only ever worked out once
+void eval_calls(decl_t *this) {
+	program = this;
+
+	for(decl_t *func = this; func; func = func->next)
+		if(type_is(func->type,TYPE_FUNCTION) && func->body)
+			while(eval_fold_stmt(func->body))
+				spec_simplify(func);
+}
+
@@ -0,0 +1,11 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "decl.h"
+#include "expr.h"
+
+expr_t *eval_global(decl_t *, decl_t *, char **);
+void eval_calls(decl_t *);
+
+#endif
+
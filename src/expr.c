@@ -1,9 +1,14 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "arg.h"
+#include "builtin.h"
 #include "cminor.h"
 #include "expr.h"
+#include "htable.h"
+#include "loop.h"
+#include "promote.h"
 #include "reg.h"
 #include "scope.h"
 #include "str.h"
@@ -36,7 +41,48 @@ static char *operators[] = {
 	[EXPR_NE] = "!="
 };
 
+// Condition code suffixes for each comparison
+static char *suffixes[] = {
+	[EXPR_EQ] = "e",
+	[EXPR_GE] = "ge",
+	[EXPR_GT] = "g",
+	[EXPR_LE] = "le",
+	[EXPR_LT] = "l",
+	[EXPR_NE] = "ne"
+};
+
+// The same comparisons, with the operands exchanged
+static expr_op_t mirrors[] = {
+	[EXPR_EQ] = EXPR_EQ,
+	[EXPR_GE] = EXPR_LE,
+	[EXPR_GT] = EXPR_LT,
+	[EXPR_LE] = EXPR_GE,
+	[EXPR_LT] = EXPR_GT,
+	[EXPR_NE] = EXPR_NE
+};
+
+// Local array initializers shorter than this are stored element by element
+#define EXPR_BULK_MIN 4
+
+// Local array initializers longer than this are copied with string
+// instructions instead of unrolled SSE moves
+#define EXPR_BULK_UNROLL_MAX 32
+
+// Branches are replaced by conditional moves only if neither value takes more
+// operations than this to compute
+#define EXPR_SPECULATE_MAX 8
+
+typedef_vector_t(vector_t(expr_ptr_t));
+
+static int nlabels = 0;
+
+static bool usedstreq = false;
+
+typedef_htable_t(size_t);
+
 static vector_t(str_t) datastrings;
+static htable_t(size_t) datastringindices;
+static vector_t(vector_t(expr_ptr_t)) datatemplates;
 
 // Returns a^b
 // Note: 0^x, where x < 0, is undefined, so we just return 0 (but 0^0 == 1)
@@ -54,6 +100,108 @@ static int64_t expr_pow(int64_t a, int64_t b) {
 	return b&1 ? a*r*r : r*r;
 }
 
+// Collects the scalar elements of a (possibly nested) array initializer
+static void expr_flatten_array(expr_t *this, vector_t(expr_ptr_t) *elems) {
+	for(; this; this = this->next) {
+		if(this->op == EXPR_ARRAY)
+			expr_flatten_array(this->left,elems);
+		else vector_append(*elems,this);
+	}
+}
+
+// Returns whether the image of an array initializer holds chars or booleans,
+// which are packed one to a byte
+static bool expr_is_packed(vector_t(expr_ptr_t) *image) {
+	for(size_t i = 0; i < image->n; i++)
+		if(image->v[i])
+			return image->v[i]->op == EXPR_BOOLEAN
+				|| image->v[i]->op == EXPR_CHARACTER;
+
+	return false;
+}
+
+// Evaluates a single constant expression, ignoring its siblings
+expr_t *expr_eval_element(expr_t *this) {
+	expr_t *next, *value;
+
+	next = this->next;
+	this->next = NULL;
+
+	value = expr_eval_constant(this);
+
+	this->next = next;
+
+	return value;
+}
+
+// Returns whether the operands may be evaluated right to left, because the
+// operator reads both of them unconditionally and neither has side effects
+static bool expr_is_reorderable(expr_t *this) {
+	switch(this->op) {
+	case EXPR_ADD:
+	case EXPR_DIVIDE:
+	case EXPR_EXPONENT:
+	case EXPR_MULTIPLY:
+	case EXPR_REMAINDER:
+	case EXPR_SUBTRACT:
+	case EXPR_EQ:
+	case EXPR_GE:
+	case EXPR_GT:
+	case EXPR_LE:
+	case EXPR_LT:
+	case EXPR_NE:
+		return !this->left->effects && !this->right->effects;
+
+	default:
+		return false;
+	}
+}
+
+// Returns whether evaluating the expression might call a function
+bool expr_contains_call(expr_t *this) {
+	if(!this)
+		return false;
+
+	if(this->op == EXPR_CALL)
+		return true;
+
+	return expr_contains_call(this->left)
+		|| expr_contains_call(this->right);
+}
+
+// Returns the index of the label for the literal s, sharing one label between
+// all the literals with the same contents
+static size_t expr_string_index(str_t s) {
+	size_t *index;
+
+	if(!datastringindices.v)
+		datastringindices = htable_new(size_t);
+
+	if(index = htable_lookup(datastringindices,s), index)
+		return *index;
+
+	htable_insert(datastringindices,s,new(size_t,{datastrings.n}));
+	vector_append(datastrings,s);
+
+	return datastrings.n - 1;
+}
+
+// Returns whether the literal is represented by all-zero words
+bool expr_is_zero(expr_t *this) {
+	switch(this->op) {
+	case EXPR_ARRAY:
+		for(expr_t *elem = this->left; elem; elem = elem->next)
+			if(!expr_is_zero(elem))
+				return false;
+		return true;
+
+	case EXPR_BOOLEAN:   return !this->b;
+	case EXPR_CHARACTER: return !this->c;
+	case EXPR_INTEGER:   return !this->i;
+	default:             return false;
+	}
+}
+
 expr_t *expr_create(expr_op_t op, expr_t *left, expr_t *right) {
 	expr_t *this = new(expr_t,{
 		.op = op,
@@ -169,7 +317,7 @@ expr_t *expr_eval_constant(expr_t *this) {
 			break;
 
 		case EXPR_REMAINDER:
-			*tail = expr_create_integer(left->i%right->b);
+			*tail = expr_create_integer(left->i%right->i);
 			break;
 
 		case EXPR_SUBSCRIPT: break;
@@ -231,31 +379,260 @@ expr_t *expr_eval_constant(expr_t *this) {
 	return head;
 }
 
-int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
-	static int nlabels = 0;
+// Initializes the local array in outreg; the constant elements are copied in
+// bulk from an image in .rodata, and only the rest are computed one by one
+static void expr_codegen_array(expr_t *this, FILE *f, int outreg) {
+	bool packed, zero;
+	int reg, subreg;
+	size_t nconstant, nwords;
+	vector_t(expr_ptr_t) elems, image;
+
+	vector_init(elems);
+	vector_init(image);
+
+	expr_flatten_array(this->left,&elems);
+
+	// Chars and booleans take a byte each, but are still copied in words
+	packed = elems.n && type_is_packed(elems.v[0]->type);
+	nwords = packed ? (elems.n + 7)/8 : elems.n;
+
+	// Find the constant elements, leaving holes for the others
+	for(size_t i = 0; i < elems.n; i++)
+		vector_append(image,elems.n >= EXPR_BULK_MIN
+			&& elems.v[i]->type->constant
+			? expr_eval_element(elems.v[i]) : NULL);
+
+	nconstant = 0;
+	zero = true;
+	for(size_t i = 0; i < image.n; i++) {
+		if(image.v[i]) {
+			nconstant++;
+			zero = zero && expr_is_zero(image.v[i]);
+		}
+	}
+
+	// Only the holes left by the bulk copy are filled in individually
+	if(nconstant && nwords > EXPR_BULK_UNROLL_MAX) {
+		reg_vacate_v(3,(reg_real_t []) {
+			zero ? REG_RAX : REG_RSI, REG_RCX, REG_RDI
+		},f);
+
+		subreg = reg_assign_subscript(outreg,0);
+		fprintf(f,"\tlea %s, %%rdi\n",reg_name(subreg));
+		reg_free(subreg);
+
+		fprintf(f,"\tmov $%zu, %%ecx\n",nwords);
+
+		if(zero) {
+			fputs("\txor %eax, %eax\n",f);
+			fputs("\trep stosq\n",f);
+		} else {
+			fprintf(f,"\tlea template$%zu(%%rip), %%rsi\n",
+				datatemplates.n);
+			fputs("\trep movsq\n",f);
+		}
+	} else if(nconstant) {
+		if(zero)
+			fputs("\tpxor %xmm0, %xmm0\n",f);
+
+		for(size_t i = 0; i < nwords; i += 2) {
+			if(!zero)
+				fprintf(f,"\t%s template$%zu+%zu(%%rip), %%xmm%zu\n",
+					i + 1 < nwords ? "movdqu" : "movq",
+					datatemplates.n,8*i,i/2%4);
+
+			subreg = reg_assign_subscript(outreg,i);
+			fprintf(f,"\t%s %%xmm%zu, %s\n",
+				i + 1 < nwords ? "movdqu" : "movq",
+				zero ? 0 : i/2%4,reg_name(subreg));
+			reg_free(subreg);
+		}
+	}
+
+	if(nconstant && !zero)
+		vector_append(datatemplates,image);
+
+	for(size_t i = 0; i < elems.n; i++) {
+		if(image.v[i])
+			continue;
+
+		if(packed) {
+			reg = expr_codegen(elems.v[i],f,false,-1);
+			if(!reg_is_constant(reg)) {
+				reg_make_temporary(&reg,f);
+				reg_make_real(reg,f);
+			}
+			fprintf(f,"\tmovb %s, %zu+%s)\n",
+				reg_name_8l(reg),i,reg_name(outreg));
+			reg_free(reg);
+			continue;
+		}
+
+		subreg = reg_assign_subscript(outreg,i);
+		reg = expr_codegen(elems.v[i],f,false,subreg);
+
+		if(reg >= 0) {
+			reg_make_temporary(&reg,f);
+			reg_make_real(reg,f);
+			fprintf(f,"\tmov %s, %s\n",
+				reg_name(reg),reg_name(subreg));
+			reg_free(reg);
+		}
+
+		reg_free(subreg);
+	}
+
+	if(!nconstant || zero)
+		vector_free(image);
+
+	vector_free(elems);
+}
+
+// Stores right in the lvalue left, returning where the value now is
+static int expr_codegen_store(int left, int right, FILE *f) {
+	int *lvalue;
+
+	if(lvalue = reg_get_lvalue(left)) {
+		reg_free_persistent(left);
+		reg_make_temporary(&right,f);
+		*lvalue = right;
+		reg_make_persistent(right);
+		reg_set_lvalue(right,lvalue);
+	} else {
+		// There is no memory-to-memory mov, and a byte can only come
+		// from the bottom of a register; a pointer counts as real when
+		// its base is, but still stands for memory
+		if((reg_is_pointer(left) || !reg_is_real(left))
+			&& !reg_is_real(right) && !reg_is_constant(right)) {
+			reg_make_temporary(&right,f);
+			reg_make_real(right,f);
+		}
+
+		reg_make_real(left,f); // Only has an effect on pointers
+
+		if(reg_is_byte(left))
+			fprintf(f,"\tmovb %s, %s)\n",
+				reg_name_8l(right),reg_name(left));
+		else fprintf(f,"\tmovq %s, %s%s\n",
+			reg_name(right),reg_name(left),
+			reg_is_pointer(left) ? ")" : "");
+		reg_free(left);
+	}
 
+	return right;
+}
+
+// Emits a cmp of left against right, returning the comparison actually made,
+// which is mirrored if the operands had to be exchanged; scratch (or a new
+// register, if it is -1) holds left if neither can be the destination
+static expr_op_t expr_codegen_cmp(expr_op_t op, int left, int right,
+	int scratch, FILE *f) {
+	int reg;
+	bool temporary;
+
+	// cmp can only take an immediate as its first operand
+	if(reg_is_constant(left) && !reg_is_constant(right)) {
+		reg = left;
+		left = right;
+		right = reg;
+		op = mirrors[op];
+	}
+
+	// There is no memory-to-memory cmp, either
+	temporary = false;
+	if(reg_is_constant(left) || !reg_is_real(left) && !reg_is_real(right)
+		&& !reg_is_constant(right)) {
+		if(temporary = scratch < 0, temporary)
+			scratch = reg_alloc(f);
+
+		fprintf(f,"\tmov %s, %s\n",reg_name(left),reg_name(scratch));
+		left = scratch;
+	}
+
+	fprintf(f,"\tcmpq %s, %s\n",reg_name(right),reg_name(left));
+
+	if(temporary)
+		reg_free(scratch);
+
+	return op;
+}
+
+int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 	int label;
-	expr_t *expr;
 	vector_t(int) regs;
 	reg_real_t *realregs;
-	size_t expri, nargs, size;
-	int left, *lvalue, reg, right, subreg;
+	size_t nargs, scale, size;
+	int left, reg, right;
+	const char *load;
+	bool packed;
+	char address[48];
+	int64_t disp;
 
 	if(!this)
 		return -1;
 
-	if(this->op != EXPR_ARRAY)
-		left = expr_codegen(this->left,f,this->op == EXPR_ASSIGN
-			|| this->op == EXPR_DECREMENT
-			|| this->op == EXPR_INCREMENT
-			|| this->op == EXPR_SUBSCRIPT,0);
+	// A loop may be keeping the element in a register, which then stands in
+	// for it just like a local variable
+	if(this->op == EXPR_SUBSCRIPT && (reg = loop_scalar(this)) >= 0)
+		return reg;
 
-	if(this->op != EXPR_AND
-		&& this->op != EXPR_CALL && this->op != EXPR_OR)
+	// A loop may already be stepping a pointer through the elements
+	if(this->op == EXPR_SUBSCRIPT && (reg = loop_address(this)) >= 0) {
+		if(wantlvalue)
+			return type_is_packed(this->type)
+				? reg_assign_byte_pointer(reg)
+				: reg_assign_pointer(reg);
+
+		left = reg_alloc(f);
+		reg_make_real(reg,f);
+		fprintf(f,"\t%s (%s), %s\n",
+			type_is_packed(this->type) ? "movzbq" : "mov",
+			reg_name(reg),reg_name(left));
+		return left;
+	}
+
+	// Evaluate the more demanding operand first, if the order does not matter
+	if(expr_is_reorderable(this) && this->right->need > this->left->need) {
 		right = expr_codegen(this->right,f,false,-1);
+		left = expr_codegen(this->left,f,false,0);
+	} else {
+		if(this->op != EXPR_ARRAY)
+			left = expr_codegen(this->left,f,
+				this->op == EXPR_ASSIGN
+				|| this->op == EXPR_DECREMENT
+				|| this->op == EXPR_INCREMENT
+				|| this->op == EXPR_SUBSCRIPT,0);
+
+		if(this->op != EXPR_AND
+			&& this->op != EXPR_CALL && this->op != EXPR_OR)
+			right = expr_codegen(this->right,f,false,-1);
+	}
 
 	switch(this->op) {
 	case EXPR_ADD:
+		if(reg_is_constant(left)) {
+			reg = left;
+			left = right;
+			right = reg;
+		}
+
+		// A named value stays put, so the sum can go straight into a
+		// new register
+		if(reg_is_constant(right) && reg_is_persistent(left)
+			&& reg_is_real(left)) {
+			reg = reg_alloc(f);
+			if(reg_is_real(left)) {
+				fprintf(f,"\tlea %"PRIi64"(%s), %s\n",
+					reg_constant_value(right),reg_name(left),
+					reg_name(reg));
+				reg_free(right);
+				return reg;
+			}
+
+			fprintf(f,"\tmov %s, %s\n",reg_name(left),reg_name(reg));
+			left = reg;
+		}
+
 		reg_make_one_temporary(&left,&right,f,NULL);
 		fprintf(f,"\tadd %s, %s\n",reg_name(right),reg_name(left));
 		reg_free(right);
@@ -264,40 +641,35 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 	case EXPR_AND:
 		label = nlabels++;
 
+		// The result must be where it is expected on both paths, so left
+		// is kept in place like any lvalue
+		reg_make_temporary(&left,f);
+		reg_set_lvalue(left,&left);
 		reg_record_lvalues();
 
-		fprintf(f,"\tcmp $0, %s\n",reg_name_8l(left));
+		fprintf(f,"\tcmpb $0, %s\n",reg_name_8l(left));
 		fprintf(f,"\tje .Lexpr_%i\n",label);
 
 		right = expr_codegen(this->right,f,false,-1);
-		reg_make_one_temporary(&left,&right,f,NULL);
+		reg_make_one_real(left,right,f);
 		fprintf(f,"\tand %s, %s\n",reg_name(right),reg_name(left));
 
 		reg_restore_lvalues(f);
+		reg_set_lvalue(left,NULL);
 		fprintf(f,"\t.Lexpr_%i:\n",label);
 
 		reg_free(right);
 		return left;
 
 	case EXPR_ASSIGN:
-		if(lvalue = reg_get_lvalue(left)) {
-			reg_free_persistent(left);
-			reg_make_temporary(&right,f);
-			*lvalue = right;
-			reg_make_persistent(right);
-			reg_set_lvalue(right,lvalue);
-		} else {
-			reg_make_one_real(left,right,f);
-			fprintf(f,"\tmov %s, %s%s\n",
-				reg_name(right),reg_name(left),
-				reg_is_pointer(left) ? ")" : "");
-			reg_free(left);
-		}
-		return right;
+		return expr_codegen_store(left,right,f);
 
 	case EXPR_CALL:
 		vector_init(regs);
 
+		// The callee may read globals being kept in registers
+		promote_codegen_store(this->left->symbol,f);
+
 		// Push arguments past the sixth onto the stack
 		nargs = arg_count(this->left->type->args);
 		if(nargs > 6) {
@@ -328,7 +700,10 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 
 		reg_map_v(9,regs.v,realregs,f);
 
-		fprintf(f,"\tcall %s\n",reg_name(left));
+		// Built-ins go to routines emitted along with the program
+		fprintf(f,"\tcall %s\n",builtin_is(this->left->symbol)
+			? builtin_codegen_label(this->left->symbol)
+			: reg_name(left));
 		reg_free(left);
 
 		for(size_t i = 0; i < regs.n; i++)
@@ -339,15 +714,21 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 		return reg_assign_real(REG_RAX);
 
 	case EXPR_DECREMENT:
+	case EXPR_INCREMENT:
 		reg = reg_alloc(f);
-		fprintf(f,"\tmov $-1, %s\n",reg_name(reg));
-		fprintf(f,"\txadd %s, %s%s\n",reg_name(reg),
+		if(reg_is_pointer(left))
+			reg_make_real(left,f);
+		fprintf(f,"\tmov %s%s, %s\n",reg_name(left),
+			reg_is_pointer(left) ? ")" : "",reg_name(reg));
+		fprintf(f,"\t%s %s%s\n",
+			this->op == EXPR_INCREMENT ? "incq" : "decq",
 			reg_name(left),reg_is_pointer(left) ? ")" : "");
 		reg_free(left);
 		return reg;
 
 	case EXPR_DIVIDE:
 		reg_make_temporary(&left,f);
+		reg_make_real(right,f); // idiv takes no immediate
 		reg_vacate_v(2,(reg_real_t []) {REG_RAX, REG_RDX},f);
 		fprintf(f,"\tmov %s, %%rax\n",reg_name(left));
 		fprintf(f,"\tcqo\n");
@@ -357,37 +738,35 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 		return left;
 
 	case EXPR_EXPONENT:
+		label = nlabels;
+		nlabels += 4;
+
 		reg = reg_alloc(f);
 		reg_make_temporary(&left,f);
 		reg_make_temporary(&right,f);
 
 		fprintf(f,"\tmov $1, %s\n",reg_name(reg));
 		fprintf(f,"\tcmp $0, %s\n",reg_name(right));
-		fprintf(f,"\tjle 0f\n");
-		fprintf(f,"3:\tcmp $1, %s\n",reg_name(right));
-		fprintf(f,"\tjle 2f\n");
+		fprintf(f,"\tjle .Lexpr_%i\n",label);
+		fprintf(f,".Lexpr_%i:\n",label + 1);
+		fprintf(f,"\tcmp $1, %s\n",reg_name(right));
+		fprintf(f,"\tjle .Lexpr_%i\n",label + 2);
 		fprintf(f,"\tshr %s\n",reg_name(right));
-		fprintf(f,"\tjnc 4f\n");
+		fprintf(f,"\tjnc .Lexpr_%i\n",label + 3);
 		fprintf(f,"\timul %s, %s\n",reg_name(left),reg_name(reg));
-		fprintf(f,"4:\timul %s, %s\n",reg_name(left),reg_name(left));
-		fprintf(f,"\tjmp 3b\n");
-		fprintf(f,"0:\tsete %s\n",reg_name_8l(left));
+		fprintf(f,".Lexpr_%i:\n",label + 3);
+		fprintf(f,"\timul %s, %s\n",reg_name(left),reg_name(left));
+		fprintf(f,"\tjmp .Lexpr_%i\n",label + 1);
+		fprintf(f,".Lexpr_%i:\n",label);
+		fprintf(f,"\tsete %s\n",reg_name_8l(left));
 		fprintf(f,"\tmovzx %s, %s\n",reg_name_8l(left),reg_name(left));
-		fprintf(f,"2:\timul %s, %s\n",reg_name(reg),reg_name(left));
-		fprintf(f,"9:\n");
+		fprintf(f,".Lexpr_%i:\n",label + 2);
+		fprintf(f,"\timul %s, %s\n",reg_name(reg),reg_name(left));
 
 		reg_free(reg);
 		reg_free(right);
 		return left;
 
-	case EXPR_INCREMENT:
-		reg = reg_alloc(f);
-		fprintf(f,"\tmov $1, %s\n",reg_name(reg));
-		fprintf(f,"\txadd %s, %s%s\n",reg_name(reg),
-			reg_name(left),reg_is_pointer(left) ? ")" : "");
-		reg_free(left);
-		return reg;
-
 	case EXPR_MULTIPLY:
 		reg_make_one_temporary(&left,&right,f,NULL);
 		fprintf(f,"\timul %s, %s\n",reg_name(right),reg_name(left));
@@ -407,16 +786,21 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 	case EXPR_OR:
 		label = nlabels++;
 
+		// The result must be where it is expected on both paths, so left
+		// is kept in place like any lvalue
+		reg_make_temporary(&left,f);
+		reg_set_lvalue(left,&left);
 		reg_record_lvalues();
 
-		fprintf(f,"\tcmp $0, %s\n",reg_name_8l(left));
+		fprintf(f,"\tcmpb $0, %s\n",reg_name_8l(left));
 		fprintf(f,"\tjne .Lexpr_%i\n",label);
 
 		right = expr_codegen(this->right,f,false,-1);
-		reg_make_one_temporary(&left,&right,f,NULL);
+		reg_make_one_real(left,right,f);
 		fprintf(f,"\tor %s, %s\n",reg_name(right),reg_name(left));
 
 		reg_restore_lvalues(f);
+		reg_set_lvalue(left,NULL);
 		fprintf(f,"\t.Lexpr_%i:\n",label);
 
 		reg_free(right);
@@ -424,6 +808,7 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 
 	case EXPR_REMAINDER:
 		reg_make_temporary(&left,f);
+		reg_make_real(right,f); // idiv takes no immediate
 		reg_vacate_v(2,(reg_real_t []) {REG_RAX, REG_RDX},f);
 		fprintf(f,"\tmov %s, %%rax\n",reg_name(left));
 		fprintf(f,"\tcqo\n");
@@ -433,18 +818,82 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 		return left;
 
 	case EXPR_SUBSCRIPT:
-		reg_make_real(left,f);
-		reg_make_temporary(&right,f);
-		reg_make_real(right,f);
-		if(size = type_size(this->left->type->subtype), size > 1)
-			fprintf(f,"\timul $%zu, %s\n",size,reg_name(right));
-		fprintf(f,"\t%s %s,%s,8), %s\n",wantlvalue ? "lea" : "mov",
-			reg_name(left),reg_name(right),reg_name(right));
-		reg_free(left);
-		return wantlvalue ? reg_assign_pointer(right) : right;
+		size = type_bytes(this->left->type->subtype);
+		packed = type_is_packed(this->type);
+
+		// A row is only ever wanted for its address
+		load = wantlvalue || type_is(this->type,TYPE_ARRAY) ? "lea"
+			: packed ? "movzbq" : "mov";
+
+		// A constant index becomes a displacement; a scalar in a local
+		// array can then be addressed directly
+		if(reg_is_constant(right) && (disp = size
+			*reg_constant_value(right), disp == (int32_t) disp)) {
+			reg_free(right);
+
+			if(wantlvalue && !reg_is_pointer(left) && !packed
+				&& !type_is(this->type,TYPE_ARRAY))
+				return reg_assign_subscript(left,disp/8);
+
+			// The address of a row (or byte) in a local array never
+			// changes
+			if(wantlvalue && !reg_is_pointer(left)) {
+				sprintf(address,"%"PRIi64"+%s)",disp,reg_name(left));
+				reg = reg_alloc_address(address,f);
+				return packed ? reg_assign_byte_pointer(reg)
+					: reg_assign_pointer(reg);
+			}
+
+			reg = reg_alloc(f);
+			reg_make_real(left,f);
+			fprintf(f,"\t%s %"PRIi64"%s%s), %s\n",load,disp,
+				reg_is_pointer(left) ? "" : "+",reg_name(left),
+				reg_name(reg));
+			reg_free(left);
+		} else {
+			// Packed rows can be any number of bytes long, which no
+			// scale covers
+			scale = size%8 == 0 ? 8 : 1;
+
+			// The base goes last, in case it was dropped to be
+			// recomputed
+			reg = right;
+			reg_make_temporary(&reg,f);
+			reg_make_real(reg,f);
+			reg_make_real(left,f);
+			if(size/scale > 1)
+				fprintf(f,"\timul $%zu, %s\n",
+					size/scale,reg_name(reg));
+			fprintf(f,"\t%s %s,%s,%zu), %s\n",load,reg_name(left),
+				reg_name(reg),scale,reg_name(reg));
+			reg_free(left);
+		}
+
+		if(!wantlvalue)
+			return reg;
+
+		return packed ? reg_assign_byte_pointer(reg)
+			: reg_assign_pointer(reg);
 
 	case EXPR_SUBTRACT:
+		if(reg_is_constant(right) && reg_is_persistent(left)
+			&& reg_is_real(left)
+			&& reg_constant_value(right) != INT32_MIN) {
+			reg = reg_alloc(f);
+			if(reg_is_real(left)) {
+				fprintf(f,"\tlea %"PRIi64"(%s), %s\n",
+					-reg_constant_value(right),reg_name(left),
+					reg_name(reg));
+				reg_free(right);
+				return reg;
+			}
+
+			fprintf(f,"\tmov %s, %s\n",reg_name(left),reg_name(reg));
+			left = reg;
+		}
+
 		reg_make_temporary(&left,f);
+		reg_make_real(left,f);
 		fprintf(f,"\tsub %s, %s\n",reg_name(right),reg_name(left));
 		reg_free(right);
 		return left;
@@ -458,34 +907,19 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 		return expr_codegen_compare(this,f,left,right);
 
 	case EXPR_ARRAY:
-		size = type_size(this->left->type);
-		for(expr = this->left, expri = 0;
-			expr; expr = expr->next, expri++) {
-			subreg = reg_assign_subscript(outreg,expri*size);
-			reg = expr_codegen(expr,f,false,subreg);
-
-			if(reg >= 0) {
-				reg_make_real(reg,f);
-				fprintf(f,"\tmov %s, %s\n",
-					reg_name(reg),reg_name(subreg));
-				reg_free(reg);
-			}
-
-			reg_free(subreg);
-		}
+		expr_codegen_array(this,f,outreg);
 		return -1;
 
 	case EXPR_BOOLEAN:
-		reg = reg_alloc(f);
-		fprintf(f,"\tmov $%i, %s\n",(int) this->b,reg_name(reg));
-		return reg;
+		return reg_assign_constant(this->b);
 
 	case EXPR_CHARACTER:
-		reg = reg_alloc(f);
-		fprintf(f,"\tmov $%i, %s\n",(int) this->c,reg_name(reg));
-		return reg;
+		return reg_assign_constant(this->c);
 
 	case EXPR_INTEGER:
+		if(reg = reg_assign_constant(this->i), reg >= 0)
+			return reg;
+
 		reg = reg_alloc(f);
 		fprintf(f,"\tmov $%"PRIi64", %s\n",this->i,reg_name(reg));
 		return reg;
@@ -499,11 +933,16 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 			return this->symbol->reg;
 
 		case SYMBOL_GLOBAL:
+			// The function may be keeping it in a register
+			if((reg = promote_reg(this->symbol)) >= 0)
+				return reg;
+
 			if(type_is(this->type,TYPE_ARRAY)) {
-				reg = reg_alloc(f);
-				fprintf(f,"\tlea %s(%%rip), %s\n",
-					this->s.v,reg_name(reg));
-				return reg_assign_pointer(reg);
+				char global[this->s.n + 7];
+
+				sprintf(global,"%s(%%rip)",this->s.v);
+				return reg_assign_pointer(
+					reg_alloc_address(global,f));
 			}
 
 			if(type_is(this->type,TYPE_FUNCTION))
@@ -513,11 +952,9 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 
 		case SYMBOL_LOCAL:
 			if(type_is(this->type,TYPE_ARRAY) && !wantlvalue) {
-				reg = reg_alloc(f);
-				fprintf(f,"\tlea %s), %s\n",
-					reg_name(this->symbol->reg),
-					reg_name(reg));
-				return reg;
+				sprintf(address,"%s)",
+					reg_name(this->symbol->reg));
+				return reg_alloc_address(address,f);
 			}
 
 			return this->symbol->reg;
@@ -526,11 +963,8 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 		break;
 
 	case EXPR_STRING:
-		reg = reg_alloc(f);
-		fprintf(f,"\tlea string$%zu(%%rip), %s\n",
-			datastrings.n,reg_name(reg));
-		vector_append(datastrings,this->s);
-		return reg;
+		sprintf(address,"string$%zu(%%rip)",expr_string_index(this->s));
+		return reg_alloc_address(address,f);
 	}
 
 	// Should never happen
@@ -539,37 +973,102 @@ int expr_codegen(expr_t *this, FILE *f, bool wantlvalue, int outreg) {
 }
 
 int expr_codegen_compare(expr_t *this, FILE *f, int left, int right) {
-	static char *suffixes[] = {
-		[EXPR_EQ] = "e",
-		[EXPR_GE] = "ge",
-		[EXPR_GT] = "g",
-		[EXPR_LE] = "le",
-		[EXPR_LT] = "l",
-		[EXPR_NE] = "ne"
-	};
+	int label, lit, reg, shift, str;
+	char *nul;
+	bool inword, swapped;
+	expr_t *literal;
+	expr_op_t op;
+	uint64_t word;
+	size_t len;
+
+	if(!type_is(this->left->type,TYPE_STRING)) {
+		// Reuse a temporary for the result, if there is one
+		if(reg_is_real(left) && !reg_is_persistent(left))
+			reg = left;
+		else if(reg_is_real(right) && !reg_is_persistent(right))
+			reg = right;
+		else reg = reg_alloc(f);
+
+		op = expr_codegen_cmp(this->op,left,right,reg,f);
+		fprintf(f,"\tset%s %s\n",suffixes[op],reg_name_8l(reg));
+		fprintf(f,"\tmovzx %s, %s\n",reg_name_8l(reg),reg_name(reg));
+
+		if(left != reg)
+			reg_free(left);
+		if(right != reg)
+			reg_free(right);
 
-	bool swapped;
+		return reg;
+	}
 
 	reg_make_one_temporary(&left,&right,f,&swapped);
+	reg_make_real(right,f); // It might be a dropped literal address
+
+	reg_vacate_v(4,(reg_real_t []) {
+		REG_RAX, REG_RCX, REG_RSI, REG_RDI},f);
+
+	label = nlabels++;
+
+	// Either side can be the literal, and the operands might be swapped
+	literal = this->right->op == EXPR_STRING ? this->right
+		: this->left->op == EXPR_STRING ? this->left : NULL;
+	if((literal == this->right) != swapped) {
+		str = left;
+		lit = right;
+	} else {
+		str = right;
+		lit = left;
+	}
+
+	// A short literal fits in one word, along with its terminator;
+	// the word can be loaded as long as it stays within the page
+	// Only the characters up to the first terminator matter
+	if(literal) {
+		nul = memchr(literal->s.v,'\0',literal->s.n);
+		len = nul ? (size_t) (nul - literal->s.v) : literal->s.n;
+	}
+
+	inword = literal && len < 8;
+
+	if(inword) {
+		shift = 64 - 8*(len + 1);
+
+		for(size_t i = word = 0; i < len; i++)
+			word |= (uint64_t) (uint8_t) literal->s.v[i] << 8*i;
+
+		fprintf(f,"\tmov %s, %%rcx\n",reg_name(str));
+		fputs("\tmov %ecx, %eax\n",f);
+		fputs("\tand $4095, %eax\n",f);
+		fputs("\tcmp $4088, %eax\n",f);
+		fprintf(f,"\tja .Lcold_expr%i\n",label);
 
-	if(type_is(this->left->type,TYPE_STRING)) {
-		reg_vacate_v(4,(reg_real_t []) {
-			REG_RAX, REG_RCX, REG_RSI, REG_RDI},f);
-
-		// String length
-		fprintf(f,"\txor %%al, %%al\n");
-		fprintf(f,"\tmov $-1, %%rcx\n");
-		fprintf(f,"\tmov %s, %%rdi\n",reg_name(left));
-		fprintf(f,"\trepne scasb\n");
-
-		// Compare strings
-		fprintf(f,"\tmov %%rdi, %%rcx\n");
-		fprintf(f,"\tsub %s, %%rcx\n",reg_name(left));
-		fprintf(f,"\tsub %%rcx, %%rdi\n");
-		fprintf(f,"\tmov %s, %%rsi\n",reg_name(right));
-		fprintf(f,"\trepe cmpsb\n");
-	} else fprintf(f,"\tcmp %s, %s\n",reg_name(swapped ? left : right),
-		reg_name(swapped ? right : left));
+		fputs("\tmov (%rcx), %rax\n",f);
+		if(shift)
+			fprintf(f,"\tshl $%i, %%rax\n",shift);
+		fprintf(f,"\tmovabs $%#"PRIx64", %%rcx\n",word << shift);
+		fputs("\tcmp %rcx, %rax\n",f);
+		fprintf(f,"\tjmp .Lexpr_%i\n",label);
+
+		fprintf(f,".Lcold_expr%i:\n",label);
+	}
+
+	fprintf(f,"\tmov %s, %%rdi\n",reg_name(str));
+	fprintf(f,"\tmov %s, %%rsi\n",reg_name(lit));
+
+	// Identical strings need not be scanned at all
+	if(!inword) {
+		fputs("\tcmp %rsi, %rdi\n",f);
+		fprintf(f,"\tje .Lexpr_%i\n",label);
+	}
+
+	fputs("\tcall streq$sse2\n",f);
+	usedstreq = true;
+
+	if(inword)
+		fprintf(f,"\tjmp .Lexpr_%i\n.Lcold_expr%i$end:\n",
+			label,label);
+
+	fprintf(f,".Lexpr_%i:\n",label);
 
 	fprintf(f,"\tset%s %s\n",suffixes[this->op],reg_name_8l(left));
 	fprintf(f,"\tmovzx %s, %s\n",reg_name_8l(left),reg_name(left));
@@ -579,6 +1078,128 @@ int expr_codegen_compare(expr_t *this, FILE *f, int left, int right) {
 	return left;
 }
 
+// Generates assign, but storing otherwise instead where cond is false, using a
+// cmov rather than branches; both values are evaluated either way
+void expr_codegen_select(expr_t *assign, expr_t *cond, expr_t *otherwise,
+	FILE *f) {
+	int left, reg, right, value;
+	char *suffix;
+
+	value = expr_codegen(assign->right,f,false,-1);
+	reg_make_temporary(&value,f);
+
+	reg = expr_codegen(otherwise,f,false,-1);
+	reg_make_temporary(&reg,f);
+
+	// A comparison can set the flags directly
+	if(cond->op >= EXPR_EQ && cond->op <= EXPR_NE
+		&& !type_is(cond->left->type,TYPE_STRING)) {
+		left = expr_codegen(cond->left,f,false,-1);
+		right = expr_codegen(cond->right,f,false,-1);
+		suffix = suffixes[expr_codegen_cmp(cond->op,left,right,-1,f)];
+		reg_free(right);
+	} else {
+		left = expr_codegen(cond,f,false,-1);
+		if(reg_is_constant(left))
+			reg_make_real(left,f);
+
+		if(reg_is_real(left))
+			fprintf(f,"\ttest %s, %s\n",
+				reg_name_8l(left),reg_name_8l(left));
+		else fprintf(f,"\tcmpb $0, %s\n",reg_name(left));
+
+		suffix = "nz";
+	}
+
+	reg_free(left);
+
+	reg_make_real(reg,f); // Just a mov, so the flags survive
+	fprintf(f,"\tcmov%s %s, %s\n",suffix,reg_name(value),reg_name(reg));
+	reg_free(value);
+
+	left = expr_codegen(assign->left,f,true,0);
+	reg_free(expr_codegen_store(left,reg,f));
+}
+
+// Returns how many operations this takes, or -1 if it must not be evaluated
+// where it is not needed: it would have effects or could fault
+static int expr_speculation_cost(expr_t *this) {
+	int left, right;
+
+	if(!this)
+		return 0;
+
+	switch(this->op) {
+	case EXPR_ADD:
+	case EXPR_MULTIPLY:
+	case EXPR_NEGATE:
+	case EXPR_NOT:
+	case EXPR_SUBTRACT:
+	case EXPR_BOOLEAN:
+	case EXPR_CHARACTER:
+	case EXPR_INTEGER:
+	case EXPR_STRING:
+		break;
+
+	case EXPR_EQ:
+	case EXPR_GE:
+	case EXPR_GT:
+	case EXPR_LE:
+	case EXPR_LT:
+	case EXPR_NE:
+		if(type_is(this->left->type,TYPE_STRING))
+			return -1;
+		break;
+
+	case EXPR_REFERENCE:
+		if(type_is(this->type,TYPE_ARRAY)
+			|| type_is(this->type,TYPE_FUNCTION))
+			return -1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	if(left = expr_speculation_cost(this->left), left < 0)
+		return -1;
+
+	if(right = expr_speculation_cost(this->right), right < 0)
+		return -1;
+
+	return 1 + left + right;
+}
+
+// Returns whether this is cheap enough to evaluate even where it is not
+// needed, in place of a possibly mispredicted branch
+bool expr_is_speculable(expr_t *this) {
+	int cost;
+
+	cost = expr_speculation_cost(this);
+
+	return cost >= 0 && cost <= EXPR_SPECULATE_MAX;
+}
+
+// Generates this for its side effects alone
+void expr_codegen_discard(expr_t *this, FILE *f) {
+	int reg;
+
+	if(!this)
+		return;
+
+	// Without the old value to return, there is nothing to exchange
+	if(this->op == EXPR_DECREMENT || this->op == EXPR_INCREMENT) {
+		reg = expr_codegen(this->left,f,true,0);
+		fprintf(f,"\t%s %s%s\n",
+			this->op == EXPR_INCREMENT ? "incq" : "decq",
+			reg_name(reg),reg_is_pointer(reg) ? ")" : "");
+		reg_free(reg);
+		return;
+	}
+
+	reg_free(expr_codegen(this,f,false,-1));
+}
+
 // Push arguments onto the stack from right to left
 void expr_codegen_push_args(expr_t *arg, FILE *f) {
 	int reg;
@@ -745,20 +1366,24 @@ void expr_print(expr_t *this) {
 	}
 }
 
-// Special print function used when generating global variable declarations
-void expr_print_asm(expr_t *this, FILE *f, bool first) {
+// Prints the values, with chars and booleans as single bytes if they are
+// packed into an array
+static void expr_print_asm_values(expr_t *this, FILE *f, bool first,
+	bool packed) {
 	for(; this; this = this->next, first = false) {
 		switch(this->op) {
 		case EXPR_ARRAY:
-			expr_print_asm(this->left,f,first);
+			expr_print_asm_values(this->left,f,first,true);
 			break;
 
 		case EXPR_BOOLEAN:
-			fprintf(f,"%s %i",first ? ".quad" : ",",(int) this->b);
+			fprintf(f,"%s %i",!first ? ","
+				: packed ? ".byte" : ".quad",(int) this->b);
 			break;
 
 		case EXPR_CHARACTER:
-			fprintf(f,"%s %i",first ? ".quad" : ",",(int) this->c);
+			fprintf(f,"%s %i",!first ? ","
+				: packed ? ".byte" : ".quad",(int) this->c);
 			break;
 
 		case EXPR_INTEGER:
@@ -768,8 +1393,7 @@ void expr_print_asm(expr_t *this, FILE *f, bool first) {
 
 		case EXPR_STRING:
 			fprintf(f,"%s string$%zu",first ? ".quad" : ",",
-				datastrings.n);
-			vector_append(datastrings,this->s);
+				expr_string_index(this->s));
 			break;
 
 		default: // Should never happen
@@ -779,26 +1403,126 @@ void expr_print_asm(expr_t *this, FILE *f, bool first) {
 	}
 }
 
+// Special print function used when generating global variable declarations
+void expr_print_asm(expr_t *this, FILE *f, bool first) {
+	expr_print_asm_values(this,f,first,false);
+}
+
 void expr_print_asm_strings(FILE *f) {
-	fputs("\t.data\n",f);
+	str_t *string;
 
 	for(size_t si = 0; si < datastrings.n; si++) {
+		string = datastrings.v + si;
+
+		// The linker merges identical strings across files, but it would
+		// split one with an embedded terminator
+		fputs(memchr(string->v,'\0',string->n) ? "\t.section .rodata\n"
+			: "\t.section .rodata.str1.1,\"aMS\",@progbits,1\n",f);
+
 		fprintf(f,"string$%zu: .string \"",si);
 
-		for(size_t ci = 0; ci < datastrings.v[si].n; ci++)
-			fprintf(f,"%s",datastrings.v[si].v[ci] == '\n' ? "\\n"
-				: datastrings.v[si].v[ci] == '\0' ? "\\000"
-				: datastrings.v[si].v[ci] == '"' ? "\\\""
-				: (char []) {datastrings.v[si].v[ci], '\0'});
+		for(size_t ci = 0; ci < string->n; ci++)
+			fprintf(f,"%s",string->v[ci] == '\n' ? "\\n"
+				: string->v[ci] == '\0' ? "\\000"
+				: string->v[ci] == '"' ? "\\\""
+				: string->v[ci] == '\\' ? "\\\\"
+				: (char []) {string->v[ci], '\0'});
 
 		fputs("\"\n",f);
 	}
 }
 
+// Emits the images used by expr_codegen_array() to initialize local arrays
+void expr_print_asm_templates(FILE *f) {
+	expr_t value;
+	bool packed;
+	size_t n;
+
+	if(!datatemplates.n)
+		return;
+
+	fputs("\t.section .rodata\n",f);
+
+	for(size_t ti = 0; ti < datatemplates.n; ti++) {
+		fprintf(f,"\t.p2align 4\ntemplate$%zu:\n",ti);
+
+		n = datatemplates.v[ti].n;
+		packed = expr_is_packed(&datatemplates.v[ti]);
+
+		for(size_t i = 0; i < n; i++) {
+			if(!datatemplates.v[ti].v[i]) { // Computed at run time
+				fputs(packed ? "\t.byte 0\n" : "\t.quad 0\n",f);
+				continue;
+			}
+
+			value = *datatemplates.v[ti].v[i];
+			value.next = NULL;
+
+			fputc('\t',f);
+			expr_print_asm_values(&value,f,true,packed);
+			fputc('\n',f);
+		}
+
+		// Packed images are still copied a word at a time
+		if(packed && n%8)
+			fprintf(f,"\t.space %zu\n",8 - n%8);
+	}
+}
+
+// Emits the helpers called by the generated code
+void expr_print_asm_runtime(FILE *f) {
+	if(!usedstreq)
+		return;
+
+	// Sets ZF if the strings at %rdi and %rsi are equal; compares 16 bytes
+	// at a time, except near the end of a page, where it goes byte by byte
+	fputs("\t.text\n"
+		"streq$sse2:\n"
+		"\tmov %edi, %eax\n"
+		"\tmov %esi, %ecx\n"
+		"\tand $4095, %eax\n"
+		"\tand $4095, %ecx\n"
+		"\tcmp $4080, %eax\n"
+		"\tja 2f\n"
+		"\tcmp $4080, %ecx\n"
+		"\tja 2f\n"
+		"\tmovdqu (%rdi), %xmm0\n"
+		"\tmovdqu (%rsi), %xmm1\n"
+		"\tpxor %xmm2, %xmm2\n"
+		"\tpcmpeqb %xmm0, %xmm2\n"
+		"\tpcmpeqb %xmm1, %xmm0\n"
+		"\tpmovmskb %xmm0, %eax\n"
+		"\tpmovmskb %xmm2, %ecx\n"
+		"\txor $0xffff, %eax\n"
+		"\tor %eax, %ecx\n"
+		"\tjnz 1f\n"
+		"\tadd $16, %rdi\n"
+		"\tadd $16, %rsi\n"
+		"\tjmp streq$sse2\n"
+		"1:\n" // The first difference or terminator decides
+		"\tbsf %ecx, %ecx\n"
+		"\tbt %ecx, %eax\n"
+		"\tsbb %eax, %eax\n"
+		"\tret\n"
+		"2:\n"
+		"\tmovzbl (%rdi), %eax\n"
+		"\tcmp (%rsi), %al\n"
+		"\tjne 3f\n"
+		"\ttest %al, %al\n"
+		"\tjz 3f\n"
+		"\tinc %rdi\n"
+		"\tinc %rsi\n"
+		"\tjmp streq$sse2\n"
+		"3:\n"
+		"\tret\n",f);
+}
+
 void expr_resolve(expr_t *this) {
 	while(this) {
 		if(this->op == EXPR_REFERENCE) {
-			if(this->symbol = scope_lookup(this->s)) {
+			// The program may define its own versions of built-ins
+			if((this->symbol = scope_lookup(this->s))
+				|| (this->symbol = builtin_lookup(this->s))) {
 				if(cminor_mode == CMINOR_RESOLVE) {
 					printf("%s resolves to ",this->s.v);
 					symbol_print(this->symbol);
@@ -828,6 +1552,38 @@ void expr_type_print(expr_t *this) {
 	this->next = next;
 }
 
+// Labels the expression with whether it has side effects and how many
+// registers it needs (its Sethi-Ullman number), given the same for its operands
+static void expr_label(expr_t *this) {
+	int left, right;
+
+	left = this->left ? this->left->need : 0;
+	right = this->right ? this->right->need : 0;
+
+	this->effects = this->op == EXPR_ASSIGN || this->op == EXPR_CALL
+		|| this->op == EXPR_DECREMENT || this->op == EXPR_INCREMENT
+		|| this->left && this->left->effects
+		|| this->right && this->right->effects;
+
+	switch(this->op) {
+	case EXPR_BOOLEAN:
+	case EXPR_CHARACTER:
+	case EXPR_INTEGER:
+	case EXPR_REFERENCE:
+	case EXPR_STRING:
+		this->need = 1;
+		break;
+
+	default:
+		if(!this->left || !this->right || this->op == EXPR_ARRAY
+			|| this->op == EXPR_CALL)
+			this->need = left > right ? left : right;
+		else this->need = left == right ? left + 1
+			: left > right ? left : right;
+		break;
+	}
+}
+
 void expr_typecheck(expr_t *this) {
 	arg_t *arg;
 	size_t m, n;
@@ -1065,6 +1821,8 @@ void expr_typecheck(expr_t *this) {
 			putchar('\n');
 		}
 
+		expr_label(this);
+
 		this = this->next;
 	}
 }
@@ -50,6 +50,9 @@ typedef struct expr {
 	struct symbol *symbol;
 	struct type *type;
 
+	bool effects; // Evaluating it has side effects
+	int need; // Registers needed to evaluate it without spilling
+
 	struct expr *left;
 	struct expr *right;
 
@@ -57,6 +60,10 @@ typedef struct expr {
 	struct expr *next;
 } expr_t;
 
+typedef expr_t *expr_ptr_t;
+
+typedef_vector_t(expr_ptr_t);
+
 expr_t *expr_create(expr_op_t, expr_t *, expr_t *);
 expr_t *expr_create_boolean(bool);
 expr_t *expr_create_character(char);
@@ -65,13 +72,21 @@ expr_t *expr_create_reference(str_t);
 expr_t *expr_create_string(str_t);
 
 expr_t *expr_eval_constant(expr_t *);
+expr_t *expr_eval_element(expr_t *);
 
 int expr_codegen(expr_t *, FILE *, bool, int);
 int expr_codegen_compare(expr_t *, FILE *, int, int);
+void expr_codegen_discard(expr_t *, FILE *);
+void expr_codegen_select(expr_t *, expr_t *, expr_t *, FILE *);
 void expr_codegen_push_args(expr_t *, FILE *);
+bool expr_contains_call(expr_t *);
+bool expr_is_speculable(expr_t *);
+bool expr_is_zero(expr_t *);
 void expr_print(expr_t *);
 void expr_print_asm(expr_t *, FILE *, bool);
+void expr_print_asm_runtime(FILE *);
 void expr_print_asm_strings(FILE *);
+void expr_print_asm_templates(FILE *);
 void expr_resolve(expr_t *);
 void expr_type_print(expr_t *);
 void expr_typecheck(expr_t *);
@@ -0,0 +1,240 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arg.h"
+#include "decl.h"
+#include "expr.h"
+#include "fold.h"
+#include "spec.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "type.h"
+#include "vector.h"
+
+typedef decl_t *decl_ptr_t;
+typedef symbol_t *symbol_ptr_t;
+
+typedef_vector_t(decl_ptr_t);
+typedef_vector_t(symbol_ptr_t);
+
+static vector_t(decl_ptr_t) funcs; // Every function with a body
+
+// Arguments being checked, which are assumed not to be written through
+// unless something else shows they are
+static vector_t(symbol_ptr_t) checking;
+
+static bool fold_has(vector_t(symbol_ptr_t) *set, symbol_t *symbol) {
+	for(size_t i = 0; i < set->n; i++)
+		if(set->v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+static decl_t *fold_find(symbol_t *symbol) {
+	for(size_t i = 0; i < funcs.n; i++)
+		if(funcs.v[i]->symbol == symbol)
+			return funcs.v[i];
+
+	return NULL;
+}
+
+// Returns the variable an lvalue or array-typed expression names, or NULL
+static symbol_t *fold_base(expr_t *this) {
+	while(this->op == EXPR_SUBSCRIPT)
+		this = this->left;
+
+	return this->op == EXPR_REFERENCE ? this->symbol : NULL;
+}
+
+static void fold_scan_stmt(stmt_t *, void (*)(expr_t *, void *), void *);
+
+static void fold_check_expr(expr_t *, void *);
+
+// Returns whether the function may change the elements of its array argument,
+// either itself or through whatever it passes it to
+static bool fold_is_written_arg(decl_t *func, arg_t *param) {
+	bool found = false;
+
+	if(fold_has(&checking,param->symbol))
+		return false;
+
+	vector_append(checking,param->symbol);
+	fold_scan_stmt(func->body,fold_check_expr,
+		(void *[]) {param->symbol, &found});
+	checking.n--;
+
+	return found;
+}
+
+// Returns whether the call could change the elements of an array argument
+static bool fold_is_passed_written(expr_t *call, expr_t *arg) {
+	decl_t *func;
+	arg_t *param;
+	expr_t *a;
+
+	if(call->left->op != EXPR_REFERENCE
+		|| !(func = fold_find(call->left->symbol)))
+		return true;
+
+	for(a = call->right, param = func->type->args; a && param;
+		a = a->next, param = param->next)
+		if(a == arg)
+			return fold_is_written_arg(func,param);
+
+	return true;
+}
+
+// Notes whether the expression changes the symbol or its elements
+static void fold_check_expr(expr_t *this, void *data) {
+	symbol_t *symbol = ((void **) data)[0];
+	bool *found = ((void **) data)[1];
+
+	for(; this; this = this->next) {
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			&& fold_base(this->left) == symbol)
+			*found = true;
+
+		// Arrays handed to a callee may be stored into
+		if(this->op == EXPR_CALL)
+			for(expr_t *arg = this->right; arg; arg = arg->next)
+				if(type_is(arg->type,TYPE_ARRAY)
+					&& fold_base(arg) == symbol
+					&& fold_is_passed_written(this,arg))
+					*found = true;
+
+		fold_check_expr(this->left,data);
+		fold_check_expr(this->right,data);
+	}
+}
+
+static void fold_scan_stmt(stmt_t *this, void (*visit)(expr_t *, void *),
+	void *data) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				visit(decl->value,data);
+
+		visit(this->init_expr,data);
+		visit(this->expr,data);
+		visit(this->next_expr,data);
+
+		fold_scan_stmt(this->body,visit,data);
+		fold_scan_stmt(this->else_body,visit,data);
+	}
+}
+
+// Returns the value a global starts with, or NULL if it cannot be written
+// as a literal
+static expr_t *fold_value(decl_t *global) {
+	if(global->value)
+		return expr_eval_constant(global->value);
+
+	switch(global->type->type) {
+	case TYPE_BOOLEAN:   return expr_create_boolean(false);
+	case TYPE_CHARACTER: return expr_create_character('\0');
+	case TYPE_INTEGER:   return expr_create_integer(0);
+	default:             return NULL;
+	}
+}
+
+// Turns the expression into the literal, in place
+static void fold_replace(expr_t *this, expr_t *value) {
+	this->op = value->op;
+	this->b = value->b;
+	this->c = value->c;
+	this->i = value->i;
+	this->s = value->s;
+	this->symbol = NULL;
+	this->left = this->right = NULL;
+}
+
+static bool fold_is_literal(expr_t *this) {
+	return this->op == EXPR_BOOLEAN || this->op == EXPR_CHARACTER
+		|| this->op == EXPR_INTEGER || this->op == EXPR_STRING;
+}
+
+// Replaces reads of the read-only globals with their values, including the
+// elements of arrays at constant indexes
+static void fold_substitute(expr_t *this, void *data) {
+	vector_t(decl_ptr_t) *globals = data;
+	expr_t *elem, *value;
+	decl_t *global;
+	int64_t i;
+
+	for(; this; this = this->next) {
+		fold_substitute(this->left,data);
+		fold_substitute(this->right,data);
+
+		if(this->op != EXPR_REFERENCE && (this->op != EXPR_SUBSCRIPT
+			|| this->left->op != EXPR_REFERENCE
+			|| this->right->op != EXPR_INTEGER))
+			continue;
+
+		for(size_t g = 0; g < globals->n; g++) {
+			global = globals->v[g];
+
+			if(this->op == EXPR_REFERENCE
+				&& this->symbol == global->symbol
+				&& !type_is(global->type,TYPE_ARRAY)) {
+				if((value = fold_value(global)))
+					fold_replace(this,value);
+			} else if(this->op == EXPR_SUBSCRIPT
+				&& this->left->symbol == global->symbol
+				&& global->value) {
+				value = expr_eval_constant(global->value);
+
+				for(elem = value->left, i = this->right->i;
+					elem && i > 0; elem = elem->next, i--);
+
+				if(elem && i == 0 && fold_is_literal(elem))
+					fold_replace(this,elem);
+			}
+		}
+	}
+}
+
+// Finds the globals which nothing in the program changes, replaces reads of
+// the scalars and constant elements of the arrays with their values, and
+// marks the arrays read-only; only valid if nothing outside the program
+// could change them either
+void fold_globals(decl_t *this) {
+	vector_t(decl_ptr_t) globals;
+	bool found;
+
+	vector_init(funcs);
+	vector_init(globals);
+	vector_init(checking);
+
+	for(decl_t *decl = this; decl; decl = decl->next)
+		if(type_is(decl->type,TYPE_FUNCTION) && decl->body)
+			vector_append(funcs,decl);
+
+	for(decl_t *decl = this; decl; decl = decl->next) {
+		if(type_is(decl->type,TYPE_FUNCTION))
+			continue;
+
+		found = false;
+		for(size_t i = 0; i < funcs.n && !found; i++)
+			fold_scan_stmt(funcs.v[i]->body,fold_check_expr,
+				(void *[]) {decl->symbol, &found});
+
+		if(found)
+			continue;
+
+		vector_append(globals,decl);
+		decl->readonly = type_is(decl->type,TYPE_ARRAY);
+	}
+
+	if(globals.n)
+		for(size_t i = 0; i < funcs.n; i++) {
+			fold_scan_stmt(funcs.v[i]->body,fold_substitute,
+				&globals);
+			spec_simplify(funcs.v[i]);
+		}
+
+	vector_free(funcs);
+	vector_free(globals);
+	vector_free(checking);
+}
@@ -0,0 +1,9 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "decl.h"
+
+void fold_globals(decl_t *);
+
+#endif
+
@@ -45,6 +45,8 @@ void htable_resize(size_t *nbins, htable_bin_header_t ***bins,
 		} while(entry != (*bins)[bini]);
 	}
 
+	free(*bins);
+
 	*nbins = newnbins;
 	*bins = newbins;
 }
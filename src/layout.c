@@ -0,0 +1,302 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cminor.h"
+#include "htable.h"
+#include "layout.h"
+#include "pp_util.h"
+#include "schedule.h"
+#include "str.h"
+#include "vector.h"
+
+// A straight-line run of instructions, entered only at the top (through one of
+// its labels) and left only at the bottom (through its exit)
+typedef struct {
+	vector_t(str_t) labels;
+	vector_t(str_t) lines;
+
+	enum {
+		EXIT_FALL,   // Falls through to the next block
+		EXIT_JUMP,   // Unconditionally jumps to target
+		EXIT_BRANCH, // Jumps to target if cond, else falls through
+		EXIT_RETURN
+	} exit;
+
+	str_t cond; // Condition code of a branch
+	str_t target; // Label jumped to
+
+	bool cold; // Predicted to (almost) never run
+	bool dead; // Unreachable
+	bool loop; // Loop header
+} block_t;
+
+typedef_vector_t(block_t);
+typedef_htable_t(size_t);
+
+static vector_t(block_t) blocks;
+static htable_t(size_t) labels;
+
+// Returns the condition code testing the opposite of cond
+static char *layout_invert(str_t cond) {
+	static char *pairs[][2] = {
+		{"e", "ne"}, {"z", "nz"}, {"l", "ge"}, {"g", "le"},
+		{"a", "be"}, {"b", "ae"}, {"s", "ns"}, {"c", "nc"},
+		{"o", "no"}, {"p", "np"}
+	};
+
+	for(size_t i = 0; i < sizeof pairs/sizeof *pairs; i++) {
+		if(strcmp(cond.v,pairs[i][0]) == 0)
+			return pairs[i][1];
+
+		if(strcmp(cond.v,pairs[i][1]) == 0)
+			return pairs[i][0];
+	}
+
+	return NULL;
+}
+
+// Returns the block labelled name, or -1 if it is not in this function
+static long layout_lookup(str_t name) {
+	size_t *index = htable_lookup(labels,name);
+
+	return index ? (long) *index : -1;
+}
+
+// Skips over blocks which do nothing but jump somewhere else
+static long layout_resolve(long b) {
+	for(size_t n = 0; b >= 0 && n < blocks.n; n++) {
+		if(blocks.v[b].lines.n || blocks.v[b].exit != EXIT_JUMP)
+			break;
+
+		b = layout_lookup(blocks.v[b].target);
+	}
+
+	return b;
+}
+
+// Returns a label for block b, inventing one if necessary
+static char *layout_label(long b) {
+	static size_t nlabels = 0;
+
+	char name[32];
+
+	if(!blocks.v[b].labels.n) {
+		sprintf(name,".Llayout_%zu",nlabels++);
+		vector_append(blocks.v[b].labels,str_new(name,strlen(name)));
+	}
+
+	return blocks.v[b].labels.v[0].v;
+}
+
+// Splits the function text into basic blocks
+static void layout_split(char *text) {
+	char *line, *end, *op;
+	size_t len, oplen;
+	block_t *block;
+	bool dead;
+	int depth;
+
+	vector_init(blocks);
+	labels = htable_new(size_t);
+
+	vector_append(blocks,(block_t) {.exit = EXIT_FALL});
+	block = blocks.v;
+
+	for(line = text, depth = 0; *line; line = *end ? end + 1 : end) {
+		end = strchr(line,'\n');
+		if(!end)
+			end = line + strlen(line);
+
+		while(line < end && isspace(*line))
+			line++;
+
+		if(len = end - line, !len)
+			continue;
+
+		// The end of a cold region is only a hint from stmt_codegen()
+		if(strncmp(line,".Lcold_",7) == 0 && line[len - 2] == 'd') {
+			depth--;
+			continue;
+		}
+
+		// Labels start a new block, unless this one is still empty
+		if(line[len - 1] == ':' && !memchr(line,' ',len)) {
+			if(block->lines.n || block->exit != EXIT_FALL) {
+				vector_append(blocks,(block_t) {
+					.exit = EXIT_FALL
+				});
+				block = blocks.v + blocks.n - 1;
+			}
+
+			vector_append(block->labels,str_new(line,len - 1));
+			htable_insert(labels,block->labels.v[
+				block->labels.n - 1],new(size_t,{blocks.n - 1}));
+
+			if(strncmp(line,".Lcold_",7) == 0)
+				depth++;
+			if(strncmp(line,".Lloop_",7) == 0)
+				block->loop = true;
+
+			block->cold = depth > 0;
+			continue;
+		}
+
+		// Anything following a terminator belongs to a new block
+		if(block->exit != EXIT_FALL) {
+			// Appending may move the blocks, so decide this first
+			dead = block->dead || block->exit != EXIT_BRANCH;
+
+			vector_append(blocks,(block_t) {
+				.exit = EXIT_FALL,
+				.cold = depth > 0,
+				.dead = dead
+			});
+			block = blocks.v + blocks.n - 1;
+		}
+
+		for(oplen = 0; oplen < len && !isspace(line[oplen]); oplen++);
+		op = line + oplen;
+		while(op < end && isspace(*op))
+			op++;
+
+		if(oplen == 3 && strncmp(line,"ret",3) == 0)
+			block->exit = EXIT_RETURN;
+		else if(line[0] == 'j') {
+			block->exit = oplen == 3 && strncmp(line,"jmp",3) == 0
+				? EXIT_JUMP : EXIT_BRANCH;
+			block->cond = str_new(line + 1,oplen - 1);
+			block->target = str_new(op,end - op);
+		} else vector_append(block->lines,str_new(line,len));
+	}
+}
+
+// Reorders the blocks of a function so that the likely path falls through and
+// the unlikely blocks are moved out of the way to the end of the function
+void layout_function(char *text, FILE *f) {
+	char *cond;
+	bool fallsinto;
+	vector_t(size_t) order;
+	long next, succ, target;
+
+	layout_split(text);
+
+	// Hot blocks keep their relative order; cold ones go at the end
+	vector_init(order);
+
+	blocks.v[0].cold = false;
+	for(size_t b = 0; b < blocks.n; b++)
+		if(!blocks.v[b].dead && !blocks.v[b].cold)
+			vector_append(order,b);
+	for(size_t b = 0; b < blocks.n; b++)
+		if(!blocks.v[b].dead && blocks.v[b].cold)
+			vector_append(order,b);
+
+	// Any block might end up being jumped to once it has been moved
+	for(size_t b = 1; b < blocks.n; b++)
+		if(!blocks.v[b].dead)
+			layout_label(b);
+
+	fallsinto = true;
+	for(size_t p = 0; p < order.n; p++) {
+		block_t *block = blocks.v + order.v[p];
+
+		next = p + 1 < order.n ? (long) order.v[p + 1] : -1;
+		succ = (long) order.v[p] + 1 < (long) blocks.n
+			? layout_resolve(order.v[p] + 1) : -1;
+		target = block->exit == EXIT_JUMP
+			|| block->exit == EXIT_BRANCH
+			? layout_resolve(layout_lookup(block->target)) : -1;
+
+		// Only pad loop headers which are not fallen into
+		if(block->loop && !block->cold && !fallsinto)
+			fputs("\t.p2align 4,,10\n",f);
+
+		for(size_t i = 0; i < block->labels.n; i++)
+			fprintf(f,"%s:\n",block->labels.v[i].v);
+
+		if(cminor_schedule)
+			schedule_block(&block->lines);
+
+		for(size_t i = 0; i < block->lines.n; i++)
+			fprintf(f,"\t%s\n",block->lines.v[i].v);
+
+		fallsinto = false;
+
+		switch(block->exit) {
+		case EXIT_FALL:
+			if(succ == next)
+				fallsinto = true;
+			else fprintf(f,"\tjmp %s\n",layout_label(succ));
+			break;
+
+		case EXIT_JUMP:
+			if(target < 0)
+				fprintf(f,"\tjmp %s\n",block->target.v);
+			else if(target == next)
+				fallsinto = true;
+			else fprintf(f,"\tjmp %s\n",layout_label(target));
+			break;
+
+		case EXIT_BRANCH:
+			cond = layout_invert(block->cond);
+
+			if(target < 0 || !cond)
+				fprintf(f,"\tj%s %s\n",block->cond.v,
+					target < 0 ? block->target.v
+					: layout_label(target));
+			else if(target == next) { // Branch around the target
+				fprintf(f,"\tj%s %s\n",
+					cond,layout_label(succ));
+				fallsinto = true;
+				break;
+			} else fprintf(f,"\tj%s %s\n",
+				block->cond.v,layout_label(target));
+
+			if(succ == next)
+				fallsinto = true;
+			else fprintf(f,"\tjmp %s\n",layout_label(succ));
+			break;
+
+		case EXIT_RETURN:
+			fputs("\tret\n",f);
+			break;
+		}
+	}
+
+	for(size_t b = 0; b < blocks.n; b++) {
+		for(size_t i = 0; i < blocks.v[b].labels.n; i++)
+			vector_free(blocks.v[b].labels.v[i]);
+		for(size_t i = 0; i < blocks.v[b].lines.n; i++)
+			vector_free(blocks.v[b].lines.v[i]);
+
+		vector_free(blocks.v[b].labels);
+		vector_free(blocks.v[b].lines);
+		vector_free(blocks.v[b].cond);
+		vector_free(blocks.v[b].target);
+	}
+
+	// The keys belong to the labels freed above
+	for(size_t i = 0; i < labels.nbins; i++) {
+		htable_bin_t(size_t) *bin, *next;
+
+		if(bin = labels.v[i], !bin)
+			continue;
+
+		// Each bin is a circular list; break it to find the end
+		next = (htable_bin_t(size_t) *) bin->head.next;
+		bin->head.next = NULL;
+
+		for(bin = next; bin; bin = next) {
+			next = (htable_bin_t(size_t) *) bin->head.next;
+			free(bin->val);
+			free(bin);
+		}
+	}
+
+	free(labels.v);
+
+	vector_free(blocks);
+	vector_free(order);
+}
@@ -0,0 +1,9 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdio.h>
+
+void layout_function(char *, FILE *);
+
+#endif
+
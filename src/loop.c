@@ -0,0 +1,1551 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decl.h"
+#include "expr.h"
+#include "loop.h"
+#include "pp_util.h"
+#include "reg.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "type.h"
+#include "vector.h"
+
+// Stepping more pointers than this through a loop would only spill them
+#define LOOP_POINTERS_MAX 6
+
+// Likewise for elements kept in registers
+#define LOOP_SCALARS_MAX 4
+
+// Deeper nests of loops are left in the order they were written
+#define LOOP_NEST_MAX 4
+
+// Elements in each block of a tiled loop; the innermost loop gets a long run
+// along a row, and the others only as many rows as keep the block in cache
+#define LOOP_TILE_INNER 256
+#define LOOP_TILE_OUTER 32
+
+// How a run of statements first treats a variable: by reading it, by
+// overwriting it, or not at all
+typedef enum {
+	LOOP_NONE,
+	LOOP_USE,
+	LOOP_DEF
+} loop_access_t;
+
+// Something in a subscript which does not change in a nest of loops
+typedef struct {
+	expr_t *expr;
+	int64_t factor;
+} loop_term_t;
+
+typedef_vector_t(loop_term_t);
+
+// A subscript in terms of the induction variables of a nest of loops
+typedef struct {
+	int64_t coefs[LOOP_NEST_MAX]; // Of each induction variable
+	int64_t offset;
+	vector_t(loop_term_t) terms;
+	int64_t size; // Bytes the element moves for each unit of the subscript
+} loop_form_t;
+
+// An element subscript in the body of a nest of loops
+typedef struct {
+	expr_t *expr;
+	symbol_t *array;
+	bool written;
+	size_t ndims;
+	loop_form_t *forms; // Outermost subscript first
+} loop_ref_t;
+
+typedef_vector_t(loop_ref_t);
+
+// How many iterations of each loop separate two references to the same
+// element, if it is known
+typedef struct {
+	int64_t dist[LOOP_NEST_MAX];
+	bool any[LOOP_NEST_MAX];
+} loop_dep_t;
+
+typedef_vector_t(loop_dep_t);
+
+typedef struct {
+	stmt_t *loops[LOOP_NEST_MAX]; // Outermost first
+	symbol_t *ivs[LOOP_NEST_MAX]; // As written, outermost first
+	size_t depth;
+
+	vector_t(loop_ref_t) refs;
+	vector_t(loop_dep_t) deps;
+
+	size_t order[LOOP_NEST_MAX]; // Which induction variable goes where
+} loop_nest_t;
+
+typedef loop_t *loop_ptr_t;
+typedef stmt_t *stmt_ptr_t;
+
+typedef_vector_t(loop_ptr_t);
+typedef_vector_t(stmt_ptr_t);
+
+static vector_t(loop_ptr_t) loops; // Loops being generated, innermost last
+
+static char *suffixes[] = {
+	[EXPR_EQ] = "e",
+	[EXPR_GE] = "ge",
+	[EXPR_GT] = "g",
+	[EXPR_LE] = "le",
+	[EXPR_LT] = "l",
+	[EXPR_NE] = "ne"
+};
+
+static expr_op_t mirrors[] = {
+	[EXPR_EQ] = EXPR_EQ,
+	[EXPR_GE] = EXPR_LE,
+	[EXPR_GT] = EXPR_LT,
+	[EXPR_LE] = EXPR_GE,
+	[EXPR_LT] = EXPR_GT,
+	[EXPR_NE] = EXPR_NE
+};
+
+// Returns whether test holds for any expression in the statements
+static bool loop_any(stmt_t *this, bool (*test)(expr_t *, void *),
+	void *data) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(decl->value && test(decl->value,data))
+					return true;
+
+		if(this->init_expr && test(this->init_expr,data)
+			|| this->expr && test(this->expr,data)
+			|| this->next_expr && test(this->next_expr,data)
+			|| loop_any(this->body,test,data)
+			|| loop_any(this->else_body,test,data))
+			return true;
+	}
+
+	return false;
+}
+
+// Returns whether the expression reads or writes symbol
+static bool loop_mentions(expr_t *this, void *symbol) {
+	for(; this; this = this->next)
+		if(this->op == EXPR_REFERENCE && this->symbol == symbol
+			|| loop_mentions(this->left,symbol)
+			|| loop_mentions(this->right,symbol))
+			return true;
+
+	return false;
+}
+
+// Returns whether the expression might change symbol
+static bool loop_writes(expr_t *this, void *symbol) {
+	for(; this; this = this->next)
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			&& this->left->op == EXPR_REFERENCE
+			&& this->left->symbol == symbol
+			|| loop_writes(this->left,symbol)
+			|| loop_writes(this->right,symbol))
+			return true;
+
+	return false;
+}
+
+// Returns whether the expression calls a function
+static bool loop_calls(expr_t *this, void *unused) {
+	for(; this; this = this->next)
+		if(this->op == EXPR_CALL || loop_calls(this->left,unused)
+			|| loop_calls(this->right,unused))
+			return true;
+
+	return false;
+}
+
+// Returns whether the statements declare symbol
+static bool loop_declares(stmt_t *this, symbol_t *symbol) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(decl->symbol == symbol)
+					return true;
+
+		if(loop_declares(this->body,symbol)
+			|| loop_declares(this->else_body,symbol))
+			return true;
+	}
+
+	return false;
+}
+
+// Returns whether anything evaluated on each iteration might change symbol;
+// a variable declared in the body is given a new value each time around
+static bool loop_changes(stmt_t *this, symbol_t *symbol) {
+	return loop_declares(this->body,symbol)
+		|| this->expr && loop_writes(this->expr,symbol)
+		|| loop_writes(this->next_expr,symbol)
+		|| loop_any(this->body,loop_writes,symbol)
+		|| symbol->level == SYMBOL_GLOBAL
+			&& (this->expr && loop_calls(this->expr,NULL)
+			|| loop_calls(this->next_expr,NULL)
+			|| loop_any(this->body,loop_calls,NULL));
+}
+
+// Returns whether the expression has the same value on every iteration
+static bool loop_is_invariant(expr_t *this, stmt_t *loop) {
+	switch(this->op) {
+	case EXPR_BOOLEAN:
+	case EXPR_CHARACTER:
+	case EXPR_INTEGER:
+		return true;
+
+	case EXPR_REFERENCE:
+		return !type_is(this->type,TYPE_ARRAY)
+			&& !type_is(this->type,TYPE_FUNCTION)
+			&& !loop_changes(loop,this->symbol);
+
+	case EXPR_ADD:
+	case EXPR_MULTIPLY:
+	case EXPR_SUBTRACT:
+		return loop_is_invariant(this->left,loop)
+			&& loop_is_invariant(this->right,loop);
+
+	case EXPR_NEGATE:
+		return loop_is_invariant(this->left,loop);
+
+	default:
+		return false;
+	}
+}
+
+// Splits the expression into *coef times the induction variable plus something
+// invariant, returning false if it cannot be
+static bool loop_affine(expr_t *this, loop_t *loop, int64_t *coef) {
+	int64_t left, right;
+
+	if(!loop_mentions(this,loop->iv)) {
+		*coef = 0;
+		return loop_is_invariant(this,loop->stmt);
+	}
+
+	switch(this->op) {
+	case EXPR_REFERENCE:
+		*coef = 1;
+		return true;
+
+	case EXPR_ADD:
+	case EXPR_SUBTRACT:
+		if(!loop_affine(this->left,loop,&left)
+			|| !loop_affine(this->right,loop,&right))
+			return false;
+
+		*coef = this->op == EXPR_ADD ? left + right : left - right;
+		return true;
+
+	case EXPR_MULTIPLY:
+		if(this->right->op == EXPR_INTEGER
+			&& loop_affine(this->left,loop,&left)) {
+			*coef = left*this->right->i;
+			return true;
+		}
+
+		if(this->left->op == EXPR_INTEGER
+			&& loop_affine(this->right,loop,&right)) {
+			*coef = right*this->left->i;
+			return true;
+		}
+
+		return false;
+
+	case EXPR_NEGATE:
+		if(!loop_affine(this->left,loop,&left))
+			return false;
+
+		*coef = -left;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Returns how many bytes the element moves for each step of the induction
+// variable by one, or 0 if it does not move in step with it
+static int64_t loop_scale(expr_t *this, loop_t *loop) {
+	int64_t coef, scale;
+
+	for(scale = 0; this->op == EXPR_SUBSCRIPT; this = this->left) {
+		if(!loop_affine(this->right,loop,&coef))
+			return 0;
+
+		scale += coef*type_bytes(this->left->type->subtype);
+	}
+
+	// Arrays are never assigned, so any named one will do as the base
+	return this->op == EXPR_REFERENCE && type_is(this->type,TYPE_ARRAY)
+		? scale : 0;
+}
+
+// Returns whether two expressions always compute the same thing
+static bool loop_same(expr_t *a, expr_t *b) {
+	if(!a || !b)
+		return a == b;
+
+	return a->op == b->op && a->b == b->b && a->c == b->c && a->i == b->i
+		&& a->symbol == b->symbol
+		&& loop_same(a->left,b->left) && loop_same(a->right,b->right);
+}
+
+// Returns the pointer (or scalar) replacing the subscript in loop, or -1
+static long loop_find(loop_t *loop, expr_t *expr, bool scalar) {
+	for(size_t i = 0; i < loop->subscripts.n; i++)
+		if(loop->subscripts.v[i].expr == expr
+			&& loop->subscripts.v[i].scalar == scalar)
+			return loop->subscripts.v[i].index;
+
+	return -1;
+}
+
+// Gives each element subscript which moves with the induction variable a
+// pointer, sharing them between identical subscripts
+static bool loop_collect(expr_t *this, void *data) {
+	loop_t *loop = data;
+	int64_t scale, stride;
+	size_t p;
+
+	for(; this; this = this->next) {
+		if(this->op != EXPR_SUBSCRIPT
+			|| type_is(this->type,TYPE_ARRAY)
+			|| (scale = loop_scale(this,loop)) == 0) {
+			loop_collect(this->left,loop);
+			loop_collect(this->right,loop);
+			continue;
+		}
+
+		for(p = 0; p < loop->pointers.n; p++)
+			if(loop_same(loop->pointers.v[p].expr,this))
+				break;
+
+		stride = scale*loop->step;
+		if(p == loop->pointers.n) {
+			if(p == LOOP_POINTERS_MAX || stride != (int32_t) stride)
+				continue;
+
+			vector_append(loop->pointers,(loop_pointer_t) {
+				.expr = this,
+				.reg = -1,
+				.stride = stride,
+				.scale = scale
+			});
+		}
+
+		vector_append(loop->subscripts,(loop_subscript_t) {
+			.expr = this,
+			.index = p
+		});
+	}
+
+	return false;
+}
+
+// Returns the array the subscript (or array reference) is into, or NULL
+static symbol_t *loop_base(expr_t *this) {
+	while(this->op == EXPR_SUBSCRIPT)
+		this = this->left;
+
+	return this->op == EXPR_REFERENCE && type_is(this->type,TYPE_ARRAY)
+		? this->symbol : NULL;
+}
+
+// Returns whether two arrays might share elements; only an array argument can
+// be the same as another name, and never the same as one of our own locals
+static bool loop_may_alias(symbol_t *a, symbol_t *b) {
+	if(a == b)
+		return true;
+
+	if(a->level == SYMBOL_LOCAL || b->level == SYMBOL_LOCAL)
+		return false;
+
+	return a->level == SYMBOL_ARG || b->level == SYMBOL_ARG;
+}
+
+// Returns whether two subscripts of the same array can never be the same
+// element
+static bool loop_distinct(expr_t *a, expr_t *b) {
+	for(; a->op == EXPR_SUBSCRIPT && b->op == EXPR_SUBSCRIPT;
+		a = a->left, b = b->left)
+		if(a->right->op == EXPR_INTEGER && b->right->op == EXPR_INTEGER
+			&& a->right->i != b->right->i)
+			return true;
+
+	return false;
+}
+
+// Lists the element subscripts which touch memory on each iteration
+static bool loop_gather(expr_t *this, void *data) {
+	vector_t(expr_ptr_t) *accesses = data;
+
+	for(; this; this = this->next) {
+		if(this->op == EXPR_SUBSCRIPT && !type_is(this->type,TYPE_ARRAY)
+			&& loop_base(this)) {
+			// An enclosing loop already keeps it in a register
+			if(loop_scalar(this) < 0)
+				vector_append(*accesses,this);
+			continue;
+		}
+
+		loop_gather(this->left,data);
+		loop_gather(this->right,data);
+	}
+
+	return false;
+}
+
+// Returns whether the expression assigns to the element
+static bool loop_stores(expr_t *this, void *element) {
+	for(; this; this = this->next)
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			&& loop_same(this->left,element)
+			|| loop_stores(this->left,element)
+			|| loop_stores(this->right,element))
+			return true;
+
+	return false;
+}
+
+// Returns whether the expression hands a callee the array, or part of it
+static bool loop_passes(expr_t *this, void *symbol) {
+	for(; this; this = this->next) {
+		if(this->op == EXPR_CALL)
+			for(expr_t *arg = this->right; arg; arg = arg->next)
+				if(type_is(arg->type,TYPE_ARRAY)
+					&& loop_base(arg) == symbol)
+					return true;
+
+		if(loop_passes(this->left,symbol)
+			|| loop_passes(this->right,symbol))
+			return true;
+	}
+
+	return false;
+}
+
+// Returns whether the statements might return from the function
+static bool loop_returns(stmt_t *this) {
+	for(; this; this = this->next)
+		if(this->op == STMT_RETURN || loop_returns(this->body)
+			|| loop_returns(this->else_body))
+			return true;
+
+	return false;
+}
+
+// Returns whether anything evaluated on each iteration satisfies test
+static bool loop_each(stmt_t *this, bool (*test)(expr_t *, void *),
+	void *data) {
+	return this->expr && test(this->expr,data)
+		|| this->next_expr && test(this->next_expr,data)
+		|| loop_any(this->body,test,data);
+}
+
+// Returns whether the element can live in a register through the loop: its
+// subscripts must not change, nothing else may touch it, and neither may a
+// callee
+static bool loop_is_scalar(expr_t *this, loop_t *loop,
+	vector_t(expr_ptr_t) *accesses) {
+	stmt_t *stmt = loop->stmt;
+	symbol_t *base;
+	expr_t *other;
+
+	if(!(base = loop_base(this)))
+		return false;
+
+	for(expr_t *sub = this; sub->op == EXPR_SUBSCRIPT; sub = sub->left)
+		if(!loop_is_invariant(sub->right,stmt))
+			return false;
+
+	for(size_t a = 0; a < accesses->n; a++) {
+		other = accesses->v[a];
+
+		if(!loop_same(this,other)
+			&& loop_may_alias(base,loop_base(other))
+			&& (base != loop_base(other) || !loop_distinct(this,other)))
+			return false;
+	}
+
+	// Only the locals which are not passed on are safe from callees
+	if(loop_each(stmt,loop_calls,NULL)
+		&& (base->level != SYMBOL_LOCAL
+		|| loop_each(stmt,loop_passes,base)))
+		return false;
+
+	// Returning skips the store, which only our own locals can afford
+	return base->level == SYMBOL_LOCAL || !loop_returns(stmt->body)
+		|| !loop_each(stmt,loop_stores,this);
+}
+
+// Picks the elements which can be kept in registers through the loop and
+// points each of their subscripts at them
+static void loop_collect_scalars(loop_t *loop) {
+	vector_t(expr_ptr_t) accesses;
+	stmt_t *stmt = loop->stmt;
+	expr_t *access;
+	size_t s;
+
+	vector_init(accesses);
+	loop_each(stmt,loop_gather,&accesses);
+
+	for(size_t a = 0; a < accesses.n; a++) {
+		access = accesses.v[a];
+
+		for(s = 0; s < loop->scalars.n; s++)
+			if(loop_same(loop->scalars.v[s].expr,access))
+				break;
+
+		if(s == loop->scalars.n) {
+			if(s == LOOP_SCALARS_MAX
+				|| !loop_is_scalar(access,loop,&accesses))
+				continue;
+
+			vector_append(loop->scalars,(loop_scalar_t) {
+				.expr = access,
+				.reg = -1,
+				.written = loop_each(stmt,loop_stores,access)
+			});
+		}
+
+		vector_append(loop->subscripts,(loop_subscript_t) {
+			.expr = access,
+			.index = s,
+			.scalar = true
+		});
+	}
+
+	vector_free(accesses);
+}
+
+// Returns whether the expression reads the induction variable other than
+// through a subscript which was given a pointer
+static bool loop_uses_iv(expr_t *this, void *data) {
+	loop_t *loop = data;
+
+	for(; this; this = this->next) {
+		if(loop_find(loop,this,false) >= 0)
+			continue;
+
+		if(this->op == EXPR_REFERENCE && this->symbol == loop->iv
+			|| loop_uses_iv(this->left,loop)
+			|| loop_uses_iv(this->right,loop))
+			return true;
+	}
+
+	return false;
+}
+
+// Returns how much the expression adds to a scalar local each time, and which
+// local it is, or 0 if it is not that simple
+static int64_t loop_step(expr_t *this, symbol_t **iv) {
+	expr_t *var, *amount;
+	int64_t step;
+
+	if(!this)
+		return 0;
+
+	switch(this->op) {
+	case EXPR_DECREMENT:
+	case EXPR_INCREMENT:
+		var = this->left;
+		step = this->op == EXPR_INCREMENT ? 1 : -1;
+		break;
+
+	case EXPR_ASSIGN:
+		var = this->left;
+		amount = this->right;
+
+		if(amount->op == EXPR_ADD && amount->left->op == EXPR_INTEGER
+			&& amount->right->op == EXPR_REFERENCE
+			&& amount->right->symbol == var->symbol)
+			step = amount->left->i;
+		else if((amount->op == EXPR_ADD
+			|| amount->op == EXPR_SUBTRACT)
+			&& amount->right->op == EXPR_INTEGER
+			&& amount->left->op == EXPR_REFERENCE
+			&& amount->left->symbol == var->symbol)
+			step = amount->op == EXPR_ADD
+				? amount->right->i : -amount->right->i;
+		else return 0;
+		break;
+
+	default:
+		return 0;
+	}
+
+	if(var->op != EXPR_REFERENCE || !type_is(var->type,TYPE_INTEGER)
+		|| var->symbol->level == SYMBOL_GLOBAL)
+		return 0;
+
+	*iv = var->symbol;
+	return step;
+}
+
+// Returns whether the expression reads or overwrites symbol first
+static loop_access_t loop_scan_expr(expr_t *this, symbol_t *symbol) {
+	if(!this || !loop_mentions(this,symbol))
+		return LOOP_NONE;
+
+	if(this->op == EXPR_ASSIGN && this->left->op == EXPR_REFERENCE
+		&& this->left->symbol == symbol
+		&& !loop_mentions(this->right,symbol))
+		return LOOP_DEF;
+
+	return LOOP_USE;
+}
+
+static loop_access_t loop_scan(stmt_t *, stmt_t *, symbol_t *);
+
+// Returns whether the statement reads or overwrites symbol first; anything
+// conditional only counts if it reads it
+static loop_access_t loop_scan_stmt(stmt_t *this, symbol_t *symbol) {
+	loop_access_t access, other;
+
+	switch(this->op) {
+	case STMT_BLOCK:
+		return loop_scan(this->body,NULL,symbol);
+
+	case STMT_DECL:
+		for(decl_t *decl = this->decl; decl; decl = decl->next)
+			if(loop_mentions(decl->value,symbol))
+				return LOOP_USE;
+		return LOOP_NONE;
+
+	case STMT_EXPR:
+		return loop_scan_expr(this->expr,symbol);
+
+	case STMT_FOR:
+		if(access = loop_scan_expr(this->init_expr,symbol), access)
+			return access;
+
+		return loop_mentions(this->expr,symbol)
+			|| loop_scan(this->body,NULL,symbol) == LOOP_USE
+			|| loop_mentions(this->next_expr,symbol)
+			? LOOP_USE : LOOP_NONE;
+
+	case STMT_IF_ELSE:
+		if(loop_mentions(this->expr,symbol))
+			return LOOP_USE;
+
+		access = loop_scan(this->body,NULL,symbol);
+		other = loop_scan(this->else_body,NULL,symbol);
+
+		if(access == LOOP_USE || other == LOOP_USE)
+			return LOOP_USE;
+
+		return access == LOOP_DEF && other == LOOP_DEF
+			? LOOP_DEF : LOOP_NONE;
+
+	case STMT_PRINT:
+		return loop_mentions(this->expr,symbol) ? LOOP_USE : LOOP_NONE;
+
+	case STMT_RETURN:
+		return loop_mentions(this->expr,symbol) ? LOOP_USE : LOOP_DEF;
+	}
+
+	return LOOP_USE; // Should never happen
+}
+
+// Scans the statements up to and including last (or all of them)
+static loop_access_t loop_scan(stmt_t *this, stmt_t *last, symbol_t *symbol) {
+	loop_access_t access;
+
+	for(; this; this = this->next) {
+		if(access = loop_scan_stmt(this,symbol), access)
+			return access;
+
+		if(this == last)
+			break;
+	}
+
+	return LOOP_NONE;
+}
+
+// Finds the statements enclosing target, outermost first
+static bool loop_path(stmt_t *this, stmt_t *target, vector_t(stmt_ptr_t) *path) {
+	for(; this; this = this->next) {
+		vector_append(*path,this);
+
+		if(this == target || loop_path(this->body,target,path)
+			|| loop_path(this->else_body,target,path))
+			return true;
+
+		path->n--;
+	}
+
+	return false;
+}
+
+// Returns whether the value symbol has when the loop finishes is never read
+static bool loop_is_dead_after(stmt_t *loop, decl_t *func, symbol_t *symbol) {
+	vector_t(stmt_ptr_t) path;
+	loop_access_t access;
+	stmt_t *parent;
+	bool dead;
+
+	vector_init(path);
+	dead = loop_path(func->body,loop,&path);
+
+	for(size_t d = path.n; dead && d-- > 0;) {
+		if(access = loop_scan(path.v[d]->next,NULL,symbol), access) {
+			dead = access == LOOP_DEF;
+			break;
+		}
+
+		// Around an enclosing loop, the value may be read again before
+		// it is overwritten
+		parent = d ? path.v[d - 1] : NULL;
+		if(parent && parent->op == STMT_FOR)
+			dead = !loop_mentions(parent->next_expr,symbol)
+				&& !loop_mentions(parent->expr,symbol)
+				&& loop_scan(parent->body,path.v[d],symbol)
+					!= LOOP_USE;
+	}
+
+	vector_free(path);
+
+	return dead;
+}
+
+// Returns whether the statements hand the body of a parallel for to other
+// threads, which would then work behind the back of anything kept in registers
+static bool loop_has_outlined(stmt_t *this) {
+	for(; this; this = this->next)
+		if(this->outlined || loop_has_outlined(this->body)
+			|| loop_has_outlined(this->else_body))
+			return true;
+
+	return false;
+}
+
+// Points each subscript of the induction variable at its first element, so
+// that it can be stepped along with it rather than recomputed; the induction
+// variable itself is dropped if only those subscripts and the test use it.
+// Elements which stay put are loaded once beforehand instead.
+loop_t *loop_codegen_enter(stmt_t *this, FILE *f, decl_t *func) {
+	expr_t *bound, *test;
+	loop_pointer_t *first;
+	symbol_t *iv = NULL;
+	int64_t step;
+	loop_t *loop;
+	int reg;
+
+	if(loop_has_outlined(this->body))
+		return NULL;
+
+	if(step = loop_step(this->next_expr,&iv), step
+		&& (this->expr && loop_writes(this->expr,iv)
+		|| loop_any(this->body,loop_writes,iv)))
+		step = 0, iv = NULL;
+
+	loop = new(loop_t,{
+		.stmt = this,
+		.iv = iv,
+		.step = step,
+		.end = -1
+	});
+
+	vector_init(loop->pointers);
+	vector_init(loop->scalars);
+	vector_init(loop->subscripts);
+
+	if(step) {
+		loop_any(this->body,loop_collect,loop);
+		if(this->expr)
+			loop_collect(this->expr,loop);
+	}
+
+	loop_collect_scalars(loop);
+
+	if(!loop->pointers.n && !loop->scalars.n) {
+		vector_free(loop->pointers);
+		vector_free(loop->scalars);
+		vector_free(loop->subscripts);
+		free(loop);
+		return NULL;
+	}
+
+	for(size_t s = 0; s < loop->scalars.n; s++) {
+		reg = expr_codegen(loop->scalars.v[s].expr,f,false,-1);
+
+		if(!reg_is_real(reg) || reg_is_persistent(reg)) {
+			int value = reg_alloc(f);
+			fprintf(f,"\tmov %s, %s\n",reg_name(reg),reg_name(value));
+			reg_free(reg);
+			reg = value;
+		}
+
+		reg_make_persistent(reg);
+		loop->scalars.v[s].reg = reg;
+	}
+
+	for(size_t s = 0; s < loop->scalars.n; s++)
+		reg_set_lvalue(loop->scalars.v[s].reg,&loop->scalars.v[s].reg);
+
+	for(size_t p = 0; p < loop->pointers.n; p++) {
+		reg = expr_codegen(loop->pointers.v[p].expr,f,true,-1);
+
+		// Elements of local arrays are addressed directly
+		if(reg_is_pointer(reg))
+			reg_make_temporary(&reg,f);
+		else {
+			int address = reg_alloc(f);
+			fprintf(f,"\tlea %s, %s\n",
+				reg_name(reg),reg_name(address));
+			reg_free(reg);
+			reg = address;
+		}
+
+		reg_make_persistent(reg);
+		loop->pointers.v[p].reg = reg;
+	}
+
+	for(size_t p = 0; p < loop->pointers.n; p++)
+		reg_set_lvalue(loop->pointers.v[p].reg,
+			&loop->pointers.v[p].reg);
+
+	// The end pointer is where the first pointer is once the test fails
+	test = this->expr;
+	first = loop->pointers.v;
+	if(loop->pointers.n && test
+		&& test->op >= EXPR_EQ && test->op <= EXPR_NE
+		&& (test->left->op == EXPR_REFERENCE
+		&& test->left->symbol == iv
+		|| test->right->op == EXPR_REFERENCE
+		&& test->right->symbol == iv)
+		&& first->scale == (int32_t) first->scale
+		&& !loop_any(this->body,loop_uses_iv,loop)
+		&& loop_is_dead_after(this,func,iv)) {
+		bound = test->left->symbol == iv ? test->right : test->left;
+		loop->test = test->left->symbol == iv
+			? test->op : mirrors[test->op];
+		if(first->scale < 0)
+			loop->test = mirrors[loop->test];
+
+		if(!loop_mentions(bound,iv)
+			&& loop_is_invariant(bound,this)) {
+			loop->end = expr_codegen(bound,f,false,-1);
+			reg_make_temporary(&loop->end,f);
+			reg_make_real(loop->end,f);
+
+			fprintf(f,"\tsub %s, %s\n",
+				reg_name(iv->reg),reg_name(loop->end));
+			fprintf(f,"\timul $%"PRIi64", %s\n",
+				first->scale,reg_name(loop->end));
+			fprintf(f,"\tadd %s, %s\n",
+				reg_name(first->reg),reg_name(loop->end));
+
+			reg_make_persistent(loop->end);
+			reg_set_lvalue(loop->end,&loop->end);
+			loop->eliminated = true;
+		}
+	}
+
+	vector_append(loops,loop);
+
+	return loop;
+}
+
+// Moves the pointers on to the next iteration
+void loop_codegen_step(loop_t *this, FILE *f) {
+	if(!this)
+		return;
+
+	for(size_t p = 0; p < this->pointers.n; p++)
+		fprintf(f,"\taddq $%"PRIi64", %s\n",
+			this->pointers.v[p].stride,
+			reg_name(this->pointers.v[p].reg));
+}
+
+// Compares the first pointer against the end pointer, returning the condition
+// code for continuing, or NULL if the loop's own test is still needed
+char *loop_codegen_test(loop_t *this, FILE *f) {
+	int reg;
+
+	if(!this || !this->eliminated)
+		return NULL;
+
+	reg = this->pointers.v[0].reg;
+
+	reg_make_one_real(reg,this->end,f);
+	fprintf(f,"\tcmpq %s, %s\n",reg_name(this->end),reg_name(reg));
+
+	return suffixes[this->test];
+}
+
+// Stores the elements kept in registers back, once the loop is over
+void loop_codegen_leave(loop_t *this, FILE *f) {
+	loop_scalar_t *scalar;
+	int reg;
+
+	if(!this)
+		return;
+
+	loops.n--;
+
+	for(size_t s = 0; s < this->scalars.n; s++) {
+		scalar = &this->scalars.v[s];
+
+		if(scalar->written) {
+			reg = expr_codegen(scalar->expr,f,true,-1);
+
+			// There is no memory-to-memory mov
+			reg_make_real(scalar->reg,f);
+			reg_make_real(reg,f); // Only has an effect on pointers
+			if(reg_is_byte(reg))
+				fprintf(f,"\tmovb %s, %s)\n",
+					reg_name_8l(scalar->reg),reg_name(reg));
+			else fprintf(f,"\tmovq %s, %s%s\n",
+				reg_name(scalar->reg),reg_name(reg),
+				reg_is_pointer(reg) ? ")" : "");
+			reg_free(reg);
+		}
+
+		reg_free_persistent(scalar->reg);
+	}
+
+	for(size_t p = 0; p < this->pointers.n; p++)
+		reg_free_persistent(this->pointers.v[p].reg);
+	reg_free_persistent(this->end);
+
+	vector_free(this->pointers);
+	vector_free(this->scalars);
+	vector_free(this->subscripts);
+	free(this);
+}
+
+// Returns the register holding the address of the subscript, if it is being
+// stepped through the loop, or -1
+int loop_address(expr_t *expr) {
+	long p;
+
+	for(size_t l = loops.n; l-- > 0;)
+		if(p = loop_find(loops.v[l],expr,false), p >= 0)
+			return loops.v[l]->pointers.v[p].reg;
+
+	return -1;
+}
+
+// Returns the register holding the value of the subscript, if it is being kept
+// there through the loop, or -1
+int loop_scalar(expr_t *expr) {
+	long s;
+
+	for(size_t l = loops.n; l-- > 0;)
+		if(s = loop_find(loops.v[l],expr,true), s >= 0)
+			return loops.v[l]->scalars.v[s].reg;
+
+	return -1;
+}
+
+
+// Returns the induction variable of a loop which counts up by one from an
+// invariant start to an invariant bound, or NULL
+static symbol_t *loop_nest_counter(stmt_t *this, stmt_t *outer) {
+	expr_t *init = this->init_expr, *test = this->expr;
+	symbol_t *iv;
+
+	if(!init || !test || loop_step(this->next_expr,&iv) != 1
+		|| iv->level != SYMBOL_LOCAL
+		|| init->next || init->op != EXPR_ASSIGN
+		|| init->left->op != EXPR_REFERENCE
+		|| init->left->symbol != iv
+		|| !loop_is_invariant(init->right,outer)
+		|| test->op != EXPR_LT && test->op != EXPR_LE
+		|| test->left->op != EXPR_REFERENCE
+		|| test->left->symbol != iv
+		|| !loop_is_invariant(test->right,outer))
+		return NULL;
+
+	return iv;
+}
+
+// Returns whether the expression assigns to anything but an array element
+static bool loop_nest_writes_scalar(expr_t *this, void *unused) {
+	for(; this; this = this->next)
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			&& this->left->op != EXPR_SUBSCRIPT
+			|| loop_nest_writes_scalar(this->left,unused)
+			|| loop_nest_writes_scalar(this->right,unused))
+			return true;
+
+	return false;
+}
+
+// Returns whether the statements are only expressions
+static bool loop_nest_is_simple(stmt_t *this) {
+	for(; this; this = this->next)
+		if(this->op == STMT_BLOCK ? !loop_nest_is_simple(this->body)
+			: this->op != STMT_EXPR)
+			return false;
+
+	return true;
+}
+
+// Adds factor times the expression to the form, returning false unless it is
+// affine in the induction variables of the nest
+static bool loop_nest_form(expr_t *this, loop_nest_t *nest, int64_t factor,
+	loop_form_t *form) {
+	for(size_t l = 0; l < nest->depth; l++)
+		if(this->op == EXPR_REFERENCE && this->symbol == nest->ivs[l]) {
+			form->coefs[l] += factor;
+			return true;
+		}
+
+	switch(this->op) {
+	case EXPR_INTEGER:
+		form->offset += factor*this->i;
+		return true;
+
+	case EXPR_ADD:
+	case EXPR_SUBTRACT:
+		return loop_nest_form(this->left,nest,factor,form)
+			&& loop_nest_form(this->right,nest,
+				this->op == EXPR_ADD ? factor : -factor,form);
+
+	case EXPR_NEGATE:
+		return loop_nest_form(this->left,nest,-factor,form);
+
+	case EXPR_MULTIPLY:
+		if(this->right->op == EXPR_INTEGER)
+			return loop_nest_form(this->left,nest,
+				factor*this->right->i,form);
+		if(this->left->op == EXPR_INTEGER)
+			return loop_nest_form(this->right,nest,
+				factor*this->left->i,form);
+		break;
+
+	default:
+		break;
+	}
+
+	// Anything else must be the same throughout the nest
+	for(size_t l = 0; l < nest->depth; l++)
+		if(loop_mentions(this,nest->ivs[l]))
+			return false;
+
+	if(!loop_is_invariant(this,nest->loops[0]))
+		return false;
+
+	vector_append(form->terms,(loop_term_t) {
+		.expr = this,
+		.factor = factor
+	});
+
+	return true;
+}
+
+// Records each element subscript in the expression, returning false if any
+// of them is not affine
+static bool loop_nest_refs(expr_t *this, loop_nest_t *nest, bool written) {
+	loop_ref_t ref;
+	expr_t *sub;
+	size_t m;
+
+	for(; this; this = this->next) {
+		if(this->op != EXPR_SUBSCRIPT) {
+			if(!loop_nest_refs(this->left,nest,
+				this->op == EXPR_ASSIGN
+				|| this->op == EXPR_DECREMENT
+				|| this->op == EXPR_INCREMENT)
+				|| !loop_nest_refs(this->right,nest,false))
+				return false;
+			continue;
+		}
+
+		if(type_is(this->type,TYPE_ARRAY) || !loop_base(this))
+			return false;
+
+		ref = (loop_ref_t) {
+			.expr = this,
+			.array = loop_base(this),
+			.written = written
+		};
+
+		// The forms are kept outermost subscript first
+		for(sub = this, ref.ndims = 0; sub->op == EXPR_SUBSCRIPT;
+			sub = sub->left)
+			ref.ndims++;
+		ref.forms = calloc(ref.ndims,sizeof *ref.forms);
+		vector_append(nest->refs,ref);
+
+		for(sub = this, m = ref.ndims; m-- > 0; sub = sub->left) {
+			vector_init(ref.forms[m].terms);
+			ref.forms[m].size = type_bytes(sub->left->type->subtype);
+
+			if(!loop_nest_form(sub->right,nest,1,ref.forms + m)
+				|| !loop_nest_refs(sub->right,nest,false))
+				return false;
+		}
+
+		written = false;
+	}
+
+	return true;
+}
+
+static bool loop_nest_refs_stmt(stmt_t *this, loop_nest_t *nest) {
+	for(; this; this = this->next)
+		if(this->op == STMT_BLOCK
+			? !loop_nest_refs_stmt(this->body,nest)
+			: !loop_nest_refs(this->expr,nest,false))
+			return false;
+
+	return true;
+}
+
+// Returns whether two affine forms differ by no more than a constant
+static bool loop_nest_is_uniform(loop_nest_t *nest, loop_form_t *a,
+	loop_form_t *b) {
+	for(size_t l = 0; l < nest->depth; l++)
+		if(a->coefs[l] != b->coefs[l])
+			return false;
+
+	if(a->terms.n != b->terms.n)
+		return false;
+
+	for(size_t t = 0; t < a->terms.n; t++)
+		if(a->terms.v[t].factor != b->terms.v[t].factor
+			|| !loop_same(a->terms.v[t].expr,b->terms.v[t].expr))
+			return false;
+
+	return true;
+}
+
+// Finds how far apart the iterations are in which the write and the other
+// reference touch the same element, returning false if that cannot be told;
+// *dependent is cleared if they never do
+static bool loop_nest_distance(loop_nest_t *nest, loop_ref_t *write,
+	loop_ref_t *other, loop_dep_t *dep, bool *dependent) {
+	loop_form_t *a, *b;
+	int64_t coef = 0, diff;
+	size_t l, nonzero, var = 0;
+
+	*dependent = true;
+	for(l = 0; l < nest->depth; l++)
+		dep->any[l] = true;
+
+	for(size_t m = 0; m < write->ndims; m++) {
+		a = write->forms + m;
+		b = other->forms + m;
+
+		if(!loop_nest_is_uniform(nest,a,b))
+			return false;
+
+		for(l = 0, nonzero = 0; l < nest->depth; l++)
+			if(a->coefs[l])
+				nonzero++, coef = a->coefs[l], var = l;
+
+		diff = a->offset - b->offset;
+
+		if(nonzero == 0) {
+			if(diff)
+				*dependent = false;
+			continue;
+		}
+
+		// Coupled subscripts are beyond this simple test
+		if(nonzero > 1)
+			return false;
+
+		l = var;
+		if(diff%coef || !dep->any[l] && dep->dist[l] != diff/coef)
+			*dependent = false;
+
+		dep->any[l] = false;
+		dep->dist[l] = diff/coef;
+	}
+
+	return true;
+}
+
+// Returns whether every pair of dependent iterations still runs the same way
+// round with the loops in the given order, outermost first; if tiled, they
+// must do so in every order
+static bool loop_nest_is_legal(loop_nest_t *nest, size_t *order, bool tiled) {
+	int sign[LOOP_NEST_MAX];
+	size_t combos, c, l, p;
+	int lead;
+
+	for(size_t d = 0; d < nest->deps.n; d++) {
+		loop_dep_t *dep = nest->deps.v + d;
+
+		// Each unknown distance may be negative, zero, or positive
+		for(l = 0, combos = 1; l < nest->depth; l++)
+			if(dep->any[l])
+				combos *= 3;
+
+		for(size_t combo = 0; combo < combos; combo++) {
+			for(l = 0, c = combo; l < nest->depth; l++)
+				if(dep->any[l])
+					sign[l] = (int) (c%3) - 1, c /= 3;
+				else sign[l] = (dep->dist[l] > 0)
+					- (dep->dist[l] < 0);
+
+			// The earlier iteration is the one which runs first
+			for(l = 0, lead = 0; l < nest->depth && !lead; l++)
+				lead = sign[l];
+			if(!lead)
+				continue;
+
+			for(l = 0; l < nest->depth; l++) {
+				sign[l] *= lead;
+				if(tiled && sign[l] < 0)
+					return false;
+			}
+
+			for(p = 0; p < nest->depth && !sign[order[p]]; p++);
+			if(sign[order[p]] < 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Returns how many bytes the reference moves for each step of loop l
+static int64_t loop_nest_stride(loop_ref_t *ref, size_t l) {
+	int64_t stride = 0;
+
+	for(size_t m = 0; m < ref->ndims; m++)
+		stride += ref->forms[m].coefs[l]*ref->forms[m].size;
+
+	return stride;
+}
+
+// Weighs how much the references would miss the cache with the loops in the
+// given order, counting inner loops much more heavily
+static int64_t loop_nest_cost(loop_nest_t *nest, size_t *order) {
+	int64_t cost = 0, stride, weight = 1;
+
+	for(size_t p = 0; p < nest->depth; p++, weight *= 8)
+		for(size_t r = 0; r < nest->refs.n; r++) {
+			stride = loop_nest_stride(nest->refs.v + r,order[p]);
+			cost += weight*(stride == 0 ? 0
+				: stride >= -8 && stride <= 8 ? 1 : 4);
+		}
+
+	return cost;
+}
+
+// Tries every order of the loops from position p in, keeping the cheapest
+// legal one
+static void loop_nest_permute(loop_nest_t *nest, size_t *order, size_t p,
+	unsigned used, int64_t *best) {
+	int64_t cost;
+
+	if(p == nest->depth) {
+		if(cost = loop_nest_cost(nest,order), cost < *best
+			&& loop_nest_is_legal(nest,order,false)) {
+			*best = cost;
+			for(size_t l = 0; l < nest->depth; l++)
+				nest->order[l] = order[l];
+		}
+		return;
+	}
+
+	for(size_t l = 0; l < nest->depth; l++)
+		if(!(used & 1u << l)) {
+			order[p] = l;
+			loop_nest_permute(nest,order,p + 1,used | 1u << l,best);
+		}
+}
+
+// Returns whether some reference which moves with the other loops stays put
+// while loop l runs
+static bool loop_nest_reuses(loop_nest_t *nest, size_t l) {
+	for(size_t r = 0; r < nest->refs.n; r++) {
+		if(loop_nest_stride(nest->refs.v + r,l))
+			continue;
+
+		for(size_t other = 0; other < nest->depth; other++)
+			if(loop_nest_stride(nest->refs.v + r,other))
+				return true;
+	}
+
+	return false;
+}
+
+static expr_t *loop_nest_ref(symbol_t *symbol) {
+	expr_t *ref = expr_create_reference(symbol->name);
+
+	ref->symbol = symbol;
+
+	return ref;
+}
+
+// Types and labels a new expression
+static expr_t *loop_nest_expr(expr_t *this) {
+	expr_typecheck(this);
+
+	return this;
+}
+
+// Returns a new local integer named after the induction variable
+static symbol_t *loop_nest_local(symbol_t *iv, char *suffix, decl_t *func,
+	decl_t **decls) {
+	type_t *type = type_create(TYPE_INTEGER,0,NULL,NULL,false);
+	char name[iv->name.n + strlen(suffix) + 1];
+	decl_t *decl;
+
+	sprintf(name,"%s%s",iv->name.v,suffix);
+
+	decl = decl_create(str_new(name,strlen(name)),type,NULL,NULL);
+	decl->symbol = symbol_create(decl->name,type,SYMBOL_LOCAL,false,func);
+	decl->next = *decls;
+	*decls = decl;
+
+	return decl->symbol;
+}
+
+// Splits the loops marked in tiles into loops over blocks, which go outside
+// all of the nest, and loops within the current block
+static void loop_nest_tile(loop_nest_t *nest, stmt_t *this, int64_t *tiles,
+	decl_t *func) {
+	stmt_t *body, **link, *inner;
+	symbol_t *block, *end;
+	expr_t *init, *limit;
+	decl_t *decls = NULL;
+	stmt_t *loop;
+
+	// The element loops keep their place, under a copy of the outermost
+	inner = stmt_create(STMT_FOR,NULL,this->init_expr,this->expr,
+		this->next_expr,this->body,NULL);
+	nest->loops[0] = inner;
+
+	*this = (stmt_t) {
+		.op = STMT_BLOCK,
+		.next = this->next
+	};
+
+	body = NULL;
+	link = &body;
+	for(size_t p = 0; p < nest->depth; p++) {
+		if(!tiles[p])
+			continue;
+
+		loop = nest->loops[p];
+		init = loop->init_expr;
+		limit = loop->expr->op == EXPR_LT ? loop->expr->right
+			: loop_nest_expr(expr_create(EXPR_ADD,loop->expr->right,
+				expr_create_integer(1)));
+
+		block = loop_nest_local(nest->ivs[nest->order[p]],"$block",
+			func,&decls);
+		end = loop_nest_local(nest->ivs[nest->order[p]],"$end",
+			func,&decls);
+
+		// for(block = start; block < limit; block = block + tile) {
+		//	end = block + tile;
+		//	if(end > limit) end = limit;
+		*link = stmt_create(STMT_FOR,NULL,
+			loop_nest_expr(expr_create(EXPR_ASSIGN,
+				loop_nest_ref(block),init->right)),
+			loop_nest_expr(expr_create(EXPR_LT,
+				loop_nest_ref(block),limit)),
+			loop_nest_expr(expr_create(EXPR_ASSIGN,
+				loop_nest_ref(block),expr_create(EXPR_ADD,
+				loop_nest_ref(block),
+				expr_create_integer(tiles[p])))),
+			NULL,NULL);
+		(*link)->body = stmt_create(STMT_EXPR,NULL,NULL,
+			loop_nest_expr(expr_create(EXPR_ASSIGN,
+				loop_nest_ref(end),expr_create(EXPR_ADD,
+				loop_nest_ref(block),
+				expr_create_integer(tiles[p])))),
+			NULL,NULL,NULL);
+		(*link)->body->next = stmt_create(STMT_IF_ELSE,NULL,NULL,
+			loop_nest_expr(expr_create(EXPR_GT,
+				loop_nest_ref(end),limit)),
+			NULL,stmt_create(STMT_EXPR,NULL,NULL,
+				loop_nest_expr(expr_create(EXPR_ASSIGN,
+				loop_nest_ref(end),limit)),
+				NULL,NULL,NULL),
+			NULL);
+		link = &(*link)->body->next->next;
+
+		// The loop within the block: for(iv = block; iv < end; iv++)
+		loop->init_expr = loop_nest_expr(expr_create(EXPR_ASSIGN,
+			init->left,loop_nest_ref(block)));
+		loop->expr = loop_nest_expr(expr_create(EXPR_LT,
+			loop->expr->left,loop_nest_ref(end)));
+	}
+
+	*link = inner;
+
+	this->body = stmt_create(STMT_DECL,decls,NULL,NULL,NULL,NULL,NULL);
+	this->body->next = body;
+}
+
+// Reorders and tiles a nest of counted loops so that the innermost one walks
+// along rows and blocks of the arrays stay in cache while they are reused;
+// returns whether the nest was changed
+static bool loop_nest_optimize_nest(stmt_t *this, decl_t *func) {
+	loop_nest_t nest = {.depth = 0};
+	stmt_t *loop, *body;
+	size_t order[LOOP_NEST_MAX], reuse;
+	int64_t best, tiles[LOOP_NEST_MAX], trip;
+	expr_t *headers[LOOP_NEST_MAX][3];
+	loop_dep_t dep;
+	bool changed, dependent, ok;
+
+	// Find the perfectly nested loops
+	for(loop = this; nest.depth < LOOP_NEST_MAX;) {
+		if(!(nest.ivs[nest.depth] = loop_nest_counter(loop,this)))
+			break;
+
+		for(size_t l = 0; l < nest.depth; l++)
+			if(nest.ivs[l] == nest.ivs[nest.depth])
+				return false;
+
+		nest.loops[nest.depth++] = loop;
+
+		for(body = loop->body; body && body->op == STMT_BLOCK
+			&& !body->next; body = body->body);
+		if(!body || body->next || body->op != STMT_FOR
+			|| body->outlined)
+			break;
+		loop = body;
+	}
+
+	if(nest.depth < 2)
+		return false;
+
+	body = nest.loops[nest.depth - 1]->body;
+	if(!loop_nest_is_simple(body)
+		|| loop_any(body,loop_calls,NULL)
+		|| loop_any(body,loop_nest_writes_scalar,NULL))
+		return false;
+
+	for(size_t l = 0; l < nest.depth; l++)
+		if(!loop_is_dead_after(this,func,nest.ivs[l]))
+			return false;
+
+	vector_init(nest.refs);
+	vector_init(nest.deps);
+
+	ok = loop_nest_refs_stmt(body,&nest);
+
+	// Every write depends on every other reference to the same element
+	for(size_t w = 0; ok && w < nest.refs.n; w++) {
+		loop_ref_t *write = nest.refs.v + w;
+
+		if(!write->written)
+			continue;
+
+		for(size_t r = 0; ok && r < nest.refs.n; r++) {
+			loop_ref_t *other = nest.refs.v + r;
+
+			if(!loop_may_alias(write->array,other->array))
+				continue;
+
+			if(ok = write->array == other->array
+				&& loop_nest_distance(&nest,write,other,&dep,
+					&dependent), ok && dependent)
+				vector_append(nest.deps,dep);
+		}
+	}
+
+	changed = false;
+	if(!ok)
+		goto done;
+
+	// Put the loop which moves along rows innermost
+	for(size_t l = 0; l < nest.depth; l++)
+		nest.order[l] = l;
+	best = loop_nest_cost(&nest,nest.order);
+	loop_nest_permute(&nest,order,0,0,&best);
+
+	// Loops inside one which reuses an element are tiled, so that a block
+	// of what they touch is still cached the next time round
+	for(reuse = 0; reuse + 1 < nest.depth; reuse++)
+		if(loop_nest_reuses(&nest,nest.order[reuse]))
+			break;
+
+	memset(tiles,0,sizeof tiles);
+	for(size_t p = reuse + 1; p < nest.depth; p++) {
+		tiles[p] = p + 1 == nest.depth ? LOOP_TILE_INNER
+			: LOOP_TILE_OUTER;
+
+		// Trip counts which are known to be small need no tiling
+		loop = nest.loops[nest.order[p]];
+		if(loop->init_expr->right->op == EXPR_INTEGER
+			&& loop->expr->right->op == EXPR_INTEGER) {
+			trip = loop->expr->right->i
+				- loop->init_expr->right->i
+				+ (loop->expr->op == EXPR_LE);
+			if(trip <= tiles[p])
+				tiles[p] = 0;
+		}
+
+		if(tiles[p])
+			changed = true;
+	}
+
+	if(changed && !loop_nest_is_legal(&nest,nest.order,true)) {
+		memset(tiles,0,sizeof tiles);
+		changed = false;
+	}
+
+	// The bounds do not depend on each other, so the loops can trade
+	// places just by trading their headers
+	for(size_t l = 0; l < nest.depth; l++) {
+		headers[l][0] = nest.loops[l]->init_expr;
+		headers[l][1] = nest.loops[l]->expr;
+		headers[l][2] = nest.loops[l]->next_expr;
+	}
+
+	for(size_t p = 0; p < nest.depth; p++) {
+		if(nest.order[p] != p)
+			changed = true;
+
+		nest.loops[p]->init_expr = headers[nest.order[p]][0];
+		nest.loops[p]->expr = headers[nest.order[p]][1];
+		nest.loops[p]->next_expr = headers[nest.order[p]][2];
+	}
+
+	for(size_t p = 0; p < nest.depth; p++)
+		if(tiles[p]) {
+			loop_nest_tile(&nest,this,tiles,func);
+			break;
+		}
+
+done:
+	for(size_t r = 0; r < nest.refs.n; r++) {
+		for(size_t m = 0; m < nest.refs.v[r].ndims; m++)
+			vector_free(nest.refs.v[r].forms[m].terms);
+		free(nest.refs.v[r].forms);
+	}
+
+	vector_free(nest.refs);
+	vector_free(nest.deps);
+
+	return changed;
+}
+
+// Interchanges and tiles each nest of loops in the statements
+static void loop_nest_optimize_stmt(stmt_t *this, decl_t *func) {
+	// The body of a parallel for is generated in a function of its own
+	for(; this; this = this->next)
+		if(!this->outlined && (this->op != STMT_FOR
+			|| !loop_nest_optimize_nest(this,func))) {
+			loop_nest_optimize_stmt(this->body,func);
+			loop_nest_optimize_stmt(this->else_body,func);
+		}
+}
+
+void loop_nest_optimize(decl_t *func) {
+	loop_nest_optimize_stmt(func->body,func);
+}
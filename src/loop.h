@@ -0,0 +1,69 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decl.h"
+#include "expr.h"
+#include "stmt.h"
+#include "vector.h"
+
+// A subscript of an induction variable, replaced by a pointer which is stepped
+// along with it
+typedef struct {
+	expr_t *expr; // The first such subscript
+	int reg; // Holds the address of the element
+	int64_t stride; // Bytes it moves each iteration
+	int64_t scale; // Bytes it moves for each unit of the induction variable
+} loop_pointer_t;
+
+typedef_vector_t(loop_pointer_t);
+
+// An element which stays put through the loop, kept in a register from
+// before it starts until after it finishes
+typedef struct {
+	expr_t *expr; // The first such subscript
+	int reg; // Holds the element's value
+	bool written; // Whether it has to be stored back afterwards
+} loop_scalar_t;
+
+typedef_vector_t(loop_scalar_t);
+
+typedef struct {
+	expr_t *expr;
+	size_t index; // Into the pointers, or the scalars if scalar is set
+	bool scalar;
+} loop_subscript_t;
+
+typedef_vector_t(loop_subscript_t);
+
+typedef struct loop {
+	stmt_t *stmt;
+	struct symbol *iv; // The induction variable
+	int64_t step; // What it is increased by on each iteration
+
+	vector_t(loop_pointer_t) pointers;
+	vector_t(loop_scalar_t) scalars;
+	vector_t(loop_subscript_t) subscripts;
+
+	// If the induction variable is only used for addressing, it is left
+	// alone and the test compares the first pointer against this instead
+	bool eliminated;
+	int end;
+	expr_op_t test;
+} loop_t;
+
+loop_t *loop_codegen_enter(stmt_t *, FILE *, decl_t *);
+void loop_codegen_step(loop_t *, FILE *);
+char *loop_codegen_test(loop_t *, FILE *);
+void loop_codegen_leave(loop_t *, FILE *);
+
+void loop_nest_optimize(decl_t *);
+
+int loop_address(expr_t *);
+int loop_scalar(expr_t *);
+
+#endif
+
@@ -0,0 +1,354 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arg.h"
+#include "cminor.h"
+#include "decl.h"
+#include "expr.h"
+#include "memo.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "type.h"
+#include "util.h"
+#include "vector.h"
+
+// Each cache holds this many results, one per slot; a new result simply
+// replaces whatever was in its slot
+#define MEMO_BITS 12
+
+// Arguments beyond the ones passed in registers are not worth the trouble
+#define MEMO_ARGS_MAX 6
+
+typedef decl_t *decl_ptr_t;
+typedef symbol_t *symbol_ptr_t;
+
+typedef_vector_t(decl_ptr_t);
+typedef_vector_t(symbol_ptr_t);
+
+static char *argregs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+static vector_t(decl_ptr_t) funcs; // Every function with a body
+static vector_t(symbol_ptr_t) written; // Globals which something changes
+
+// Functions which may run on several threads at once, whose caches could be
+// left with torn entries
+static vector_t(symbol_ptr_t) threaded;
+
+static bool memo_is_written(symbol_t *symbol) {
+	for(size_t i = 0; i < written.n; i++)
+		if(written.v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+static bool memo_is_threaded(symbol_t *symbol) {
+	for(size_t i = 0; i < threaded.n; i++)
+		if(threaded.v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+static decl_t *memo_find(symbol_t *symbol) {
+	for(size_t i = 0; i < funcs.n; i++)
+		if(funcs.v[i]->symbol == symbol)
+			return funcs.v[i];
+
+	return NULL;
+}
+
+// Returns the array an array-typed expression names, or NULL
+static symbol_t *memo_base(expr_t *this) {
+	while(this->op == EXPR_SUBSCRIPT)
+		this = this->left;
+
+	return this->op == EXPR_REFERENCE ? this->symbol : NULL;
+}
+
+// Notes each global the expression might change, including arrays handed to
+// a callee, which could store into them
+static void memo_scan_writes(expr_t *this) {
+	symbol_t *symbol;
+
+	for(; this; this = this->next) {
+		symbol = NULL;
+
+		if(this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			symbol = memo_base(this->left);
+
+		if(symbol && symbol->level == SYMBOL_GLOBAL
+			&& !memo_is_written(symbol))
+			vector_append(written,symbol);
+
+		if(this->op == EXPR_CALL)
+			for(expr_t *arg = this->right; arg; arg = arg->next)
+				if(type_is(arg->type,TYPE_ARRAY)
+					&& (symbol = memo_base(arg))
+					&& symbol->level == SYMBOL_GLOBAL
+					&& !memo_is_written(symbol))
+					vector_append(written,symbol);
+
+		memo_scan_writes(this->left);
+		memo_scan_writes(this->right);
+	}
+}
+
+static void memo_scan_writes_stmt(stmt_t *this) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				memo_scan_writes(decl->value);
+
+		memo_scan_writes(this->init_expr);
+		memo_scan_writes(this->expr);
+		memo_scan_writes(this->next_expr);
+		memo_scan_writes_stmt(this->body);
+		memo_scan_writes_stmt(this->else_body);
+	}
+}
+
+static void memo_scan_calls(expr_t *this) {
+	for(; this; this = this->next) {
+		if(this->op == EXPR_CALL
+			&& !memo_is_threaded(this->left->symbol))
+			vector_append(threaded,this->left->symbol);
+
+		memo_scan_calls(this->left);
+		memo_scan_calls(this->right);
+	}
+}
+
+// Notes each function called from the body of a parallel for, or from
+// anywhere in the statements if they are inside one
+static void memo_scan_threaded(stmt_t *this, bool inside) {
+	for(; this; this = this->next) {
+		if(inside) {
+			if(this->op == STMT_DECL)
+				for(decl_t *decl = this->decl; decl;
+					decl = decl->next)
+					memo_scan_calls(decl->value);
+
+			memo_scan_calls(this->init_expr);
+			memo_scan_calls(this->expr);
+			memo_scan_calls(this->next_expr);
+		}
+
+		memo_scan_threaded(this->body,inside || this->parallel);
+		memo_scan_threaded(this->else_body,inside);
+	}
+}
+
+// Returns whether evaluating the expression depends only on the arguments
+// and has no effect outside the call
+static bool memo_is_pure_expr(expr_t *this) {
+	decl_t *callee;
+
+	for(; this; this = this->next) {
+		if(this->op == EXPR_REFERENCE
+			&& this->symbol->level == SYMBOL_GLOBAL
+			&& !type_is(this->type,TYPE_FUNCTION)
+			&& memo_is_written(this->symbol))
+			return false;
+
+		if(this->op == EXPR_CALL && (!(callee = memo_find(
+			this->left->symbol)) || !callee->memoize))
+			return false;
+
+		if(!memo_is_pure_expr(this->left)
+			|| !memo_is_pure_expr(this->right))
+			return false;
+	}
+
+	return true;
+}
+
+static bool memo_is_pure(stmt_t *this) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_PRINT)
+			return false;
+
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(!memo_is_pure_expr(decl->value))
+					return false;
+
+		if(!memo_is_pure_expr(this->init_expr)
+			|| !memo_is_pure_expr(this->expr)
+			|| !memo_is_pure_expr(this->next_expr)
+			|| !memo_is_pure(this->body)
+			|| !memo_is_pure(this->else_body))
+			return false;
+	}
+
+	return true;
+}
+
+static bool memo_calls(expr_t *this) {
+	for(; this; this = this->next)
+		if(this->op == EXPR_CALL || memo_calls(this->left)
+			|| memo_calls(this->right))
+			return true;
+
+	return false;
+}
+
+// Returns whether the statements call anything or loop, without which a
+// lookup would cost more than it saves
+static bool memo_is_costly(stmt_t *this) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(memo_calls(decl->value))
+					return true;
+
+		if(this->op == STMT_FOR || memo_calls(this->expr)
+			|| memo_is_costly(this->body)
+			|| memo_is_costly(this->else_body))
+			return true;
+	}
+
+	return false;
+}
+
+// Returns whether results of the type fit in a word and can be compared
+static bool memo_is_scalar(type_t *type) {
+	return type_is(type,TYPE_BOOLEAN) || type_is(type,TYPE_CHARACTER)
+		|| type_is(type,TYPE_INTEGER);
+}
+
+// Marks the functions whose results depend only on their scalar arguments,
+// and which are worth caching
+void memo_analyze(decl_t *this) {
+	bool changed;
+	decl_t *func;
+
+	vector_init(funcs);
+	vector_init(written);
+	vector_init(threaded);
+
+	for(; this; this = this->next)
+		if(type_is(this->type,TYPE_FUNCTION) && this->body) {
+			vector_append(funcs,this);
+			memo_scan_writes_stmt(this->body);
+		}
+
+	// Whatever the parallel fors call, directly or not, may be running on
+	// several threads
+	if(cminor_parallel && !cminor_freestanding) {
+		for(size_t i = 0; i < funcs.n; i++)
+			memo_scan_threaded(funcs.v[i]->body,false);
+
+		for(size_t i = 0; i < threaded.n; i++)
+			if((func = memo_find(threaded.v[i])))
+				memo_scan_threaded(func->body,true);
+	}
+
+	// Start from every candidate and strike out the ones which are not
+	// pure, until none of the rest calls one of those
+	for(size_t i = 0; i < funcs.n; i++) {
+		func = funcs.v[i];
+
+		func->memoize = strcmp(func->name.v,"main") != 0
+			&& !memo_is_threaded(func->symbol)
+			&& memo_is_scalar(func->type->subtype)
+			&& arg_count(func->type->args) <= MEMO_ARGS_MAX;
+
+		for(arg_t *arg = func->type->args; arg; arg = arg->next)
+			if(!memo_is_scalar(arg->type))
+				func->memoize = false;
+	}
+
+	do {
+		changed = false;
+
+		for(size_t i = 0; i < funcs.n; i++) {
+			func = funcs.v[i];
+
+			if(func->memoize && !memo_is_pure(func->body)) {
+				func->memoize = false;
+				changed = true;
+			}
+		}
+	} while(changed);
+
+	for(size_t i = 0; i < funcs.n; i++) {
+		func = funcs.v[i];
+
+		if(func->memoize && !memo_is_costly(func->body))
+			func->memoize = false;
+
+		if(func->memoize)
+			note("memoizing %s",func->name.v);
+	}
+
+	vector_free(funcs);
+	vector_free(written);
+	vector_free(threaded);
+}
+
+// Emits the function's entry point, which looks the arguments up in its cache
+// and only calls the body proper (at name$body) if they are not there
+void memo_codegen_entry(decl_t *this, FILE *f) {
+	size_t nargs = arg_count(this->type->args);
+	size_t entry = 8*(nargs + 2); // Valid, arguments, result
+	char *name = this->name.v;
+
+	fprintf(f,"%s:\n",name);
+	fputs("\tpush %rbp\n",f);
+	fputs("\tmov %rsp, %rbp\n",f);
+
+	// Hash the arguments into a slot
+	fputs("\tmovabs $-7046029254386353131, %r11\n",f);
+	fputs("\txor %eax, %eax\n",f);
+	for(size_t i = 0; i < nargs; i++) {
+		fprintf(f,"\txor %%%s, %%rax\n",argregs[i]);
+		fputs("\timul %r11, %rax\n",f);
+	}
+	fprintf(f,"\tshr $%i, %%rax\n",64 - MEMO_BITS);
+	fprintf(f,"\timul $%zu, %%rax\n",entry);
+	fprintf(f,"\tlea %s$memo(%%rip), %%r10\n",name);
+	fputs("\tadd %rax, %r10\n",f);
+
+	fputs("\tcmpq $0, (%r10)\n",f);
+	fprintf(f,"\tje .L%s$miss\n",name);
+	for(size_t i = 0; i < nargs; i++) {
+		fprintf(f,"\tcmp %zu(%%r10), %%%s\n",8*(i + 1),argregs[i]);
+		fprintf(f,"\tjne .L%s$miss\n",name);
+	}
+	fprintf(f,"\tmov %zu(%%r10), %%rax\n",8*(nargs + 1));
+	fputs("\tpop %rbp\n",f);
+	fputs("\tret\n",f);
+
+	// Otherwise, compute the result and fill the slot, evicting whatever
+	// was there before
+	fprintf(f,".L%s$miss:\n",name);
+	fprintf(f,"\tsub $%zu, %%rsp\n",(8*(nargs + 1) + 15)/16*16);
+	fputs("\tmov %r10, -8(%rbp)\n",f);
+	for(size_t i = 0; i < nargs; i++)
+		fprintf(f,"\tmov %%%s, %i(%%rbp)\n",argregs[i],
+			-8*((int) i + 2));
+	fprintf(f,"\tcall %s$body\n",name);
+	fputs("\tmov -8(%rbp), %r10\n",f);
+	fputs("\tmovq $1, (%r10)\n",f);
+	for(size_t i = 0; i < nargs; i++) {
+		fprintf(f,"\tmov %i(%%rbp), %%rcx\n",-8*((int) i + 2));
+		fprintf(f,"\tmov %%rcx, %zu(%%r10)\n",8*(i + 1));
+	}
+	fprintf(f,"\tmov %%rax, %zu(%%r10)\n",8*(nargs + 1));
+	fputs("\tmov %rbp, %rsp\n",f);
+	fputs("\tpop %rbp\n",f);
+	fputs("\tret\n",f);
+
+	fprintf(f,"%s$body:\n",name);
+}
+
+// Emits the function's cache, which starts out empty
+void memo_codegen_cache(decl_t *this, FILE *f) {
+	size_t nargs = arg_count(this->type->args);
+
+	fprintf(f,"\t.bss\n\t.p2align 3\n%s$memo: .space %zu\n",
+		this->name.v,8*(nargs + 2) << MEMO_BITS);
+}
@@ -0,0 +1,13 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdio.h>
+
+#include "decl.h"
+
+void memo_analyze(decl_t *);
+void memo_codegen_entry(decl_t *, FILE *);
+void memo_codegen_cache(decl_t *, FILE *);
+
+#endif
+
@@ -0,0 +1,521 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arg.h"
+#include "decl.h"
+#include "expr.h"
+#include "outline.h"
+#include "promote.h"
+#include "reg.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "type.h"
+#include "vector.h"
+#include "pp_util.h"
+
+typedef symbol_t *symbol_ptr_t;
+
+typedef_vector_t(symbol_ptr_t);
+
+// A variable the body of a parallel for shares with the rest of its function,
+// passed to every thread through an array in the function's frame
+typedef struct {
+	symbol_t *outer; // In the original function
+	symbol_t *inner; // In the body's own function
+	bool sum; // Only ever added to, so each thread keeps its own total
+} outline_capture_t;
+
+typedef_vector_t(outline_capture_t);
+
+// The body of a parallel for, moved into a function of its own which runs a
+// range of its iterations
+typedef struct {
+	decl_t *func;
+	symbol_t *iv; // The induction variable, in func
+
+	vector_t(outline_capture_t) captures;
+	vector_t(symbol_ptr_t) locals; // Declared inside the body
+
+	// The iterations may take very different amounts of time, so they are
+	// handed out a chunk at a time rather than split evenly up front
+	bool chunked;
+} outline_t;
+
+typedef outline_t *outline_ptr_t;
+
+typedef_vector_t(outline_ptr_t);
+
+static vector_t(outline_ptr_t) outlines;
+
+static void *outline_dup(void *p, size_t size) {
+	return memcpy(malloc(size),p,size);
+}
+
+static outline_t *outline_find(decl_t *func) {
+	for(size_t i = 0; i < outlines.n; i++)
+		if(outlines.v[i]->func == func)
+			return outlines.v[i];
+
+	return NULL;
+}
+
+static bool outline_has(vector_t(symbol_ptr_t) *set, symbol_t *symbol) {
+	for(size_t i = 0; i < set->n; i++)
+		if(set->v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+static outline_capture_t *outline_capture(outline_t *outline,
+	symbol_t *symbol) {
+	for(size_t i = 0; i < outline->captures.n; i++)
+		if(outline->captures.v[i].outer == symbol)
+			return outline->captures.v + i;
+
+	return NULL;
+}
+
+static expr_t *outline_reference(symbol_t *symbol) {
+	expr_t *this = expr_create_reference(symbol->name);
+
+	this->symbol = symbol;
+	this->type = symbol->type;
+
+	return this;
+}
+
+// Notes the variables declared inside the statements
+static void outline_scan_locals(stmt_t *this, outline_t *outline) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				vector_append(outline->locals,decl->symbol);
+
+		outline_scan_locals(this->body,outline);
+		outline_scan_locals(this->else_body,outline);
+	}
+}
+
+// Notes the locals and arguments of the original function which the
+// expressions use, and which of them they add to
+static void outline_scan_expr(expr_t *this, outline_t *outline,
+	symbol_t *iv) {
+	outline_capture_t *capture;
+
+	for(; this; this = this->next) {
+		outline_scan_expr(this->left,outline,iv);
+		outline_scan_expr(this->right,outline,iv);
+
+		if(this->op == EXPR_REFERENCE
+			&& this->symbol->level != SYMBOL_GLOBAL
+			&& this->symbol != iv
+			&& !outline_has(&outline->locals,this->symbol)
+			&& !outline_capture(outline,this->symbol))
+			vector_append(outline->captures,(outline_capture_t) {
+				.outer = this->symbol
+			});
+
+		// The typechecker only lets a parallel for add to them
+		if(this->op == EXPR_ASSIGN && this->left->op == EXPR_REFERENCE
+			&& (capture = outline_capture(outline,
+			this->left->symbol)))
+			capture->sum = true;
+	}
+}
+
+static void outline_scan_stmt(stmt_t *this, outline_t *outline,
+	symbol_t *iv) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				outline_scan_expr(decl->value,outline,iv);
+
+		outline_scan_expr(this->init_expr,outline,iv);
+		outline_scan_expr(this->expr,outline,iv);
+		outline_scan_expr(this->next_expr,outline,iv);
+
+		outline_scan_stmt(this->body,outline,iv);
+		outline_scan_stmt(this->else_body,outline,iv);
+	}
+}
+
+// Returns whether the expression depends on the iteration it is evaluated in
+static bool outline_varies(expr_t *this, outline_t *outline, symbol_t *iv) {
+	for(; this; this = this->next)
+		if(this->op == EXPR_REFERENCE && (this->symbol == iv
+			|| outline_has(&outline->locals,this->symbol))
+			|| outline_varies(this->left,outline,iv)
+			|| outline_varies(this->right,outline,iv))
+			return true;
+
+	return false;
+}
+
+// Returns whether the iterations may take very different amounts of time:
+// they branch, call something, or loop a number of times which depends on
+// the iteration
+static bool outline_is_uneven(stmt_t *this, outline_t *outline,
+	symbol_t *iv) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_IF_ELSE
+			|| expr_contains_call(this->expr)
+			|| expr_contains_call(this->init_expr)
+			|| expr_contains_call(this->next_expr))
+			return true;
+
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(expr_contains_call(decl->value))
+					return true;
+
+		if(this->op == STMT_FOR
+			&& (outline_varies(this->init_expr,outline,iv)
+			|| outline_varies(this->expr,outline,iv)))
+			return true;
+
+		if(outline_is_uneven(this->body,outline,iv)
+			|| outline_is_uneven(this->else_body,outline,iv))
+			return true;
+	}
+
+	return false;
+}
+
+// Returns what the symbol stands for inside the body's own function
+static symbol_t *outline_map(outline_t *outline, symbol_t *symbol,
+	symbol_t *iv) {
+	outline_capture_t *capture;
+
+	if(symbol == iv)
+		return outline->iv;
+
+	if((capture = outline_capture(outline,symbol)))
+		return capture->inner;
+
+	return symbol;
+}
+
+// Copies the expressions, switching them over to the body's own variables
+static expr_t *outline_copy_expr(expr_t *this, outline_t *outline,
+	symbol_t *iv) {
+	expr_t *head = NULL, **tail = &head;
+	expr_t *copy;
+
+	for(; this; this = this->next) {
+		copy = outline_dup(this,sizeof *copy);
+		if(copy->symbol)
+			copy->symbol = outline_map(outline,copy->symbol,iv);
+
+		copy->left = outline_copy_expr(this->left,outline,iv);
+		copy->right = outline_copy_expr(this->right,outline,iv);
+
+		if(copy->left)
+			copy->left->parent = copy;
+		if(copy->right)
+			copy->right->parent = copy;
+
+		copy->next = NULL;
+		*tail = copy;
+		tail = &copy->next;
+	}
+
+	return head;
+}
+
+// Locals declared inside the body keep their symbols, which it no longer
+// shares with the original function
+static stmt_t *outline_copy_stmt(stmt_t *this, outline_t *outline,
+	symbol_t *iv) {
+	stmt_t *head = NULL, **tail = &head;
+	decl_t **decltail;
+	stmt_t *copy;
+
+	for(; this; this = this->next) {
+		copy = outline_dup(this,sizeof *copy);
+
+		for(decltail = &copy->decl; *decltail;
+			decltail = &(*decltail)->next) {
+			*decltail = outline_dup(*decltail,sizeof **decltail);
+			(*decltail)->value = outline_copy_expr(
+				(*decltail)->value,outline,iv);
+		}
+
+		copy->init_expr = outline_copy_expr(this->init_expr,outline,iv);
+		copy->expr = outline_copy_expr(this->expr,outline,iv);
+		copy->next_expr = outline_copy_expr(this->next_expr,outline,iv);
+		copy->body = outline_copy_stmt(this->body,outline,iv);
+		copy->else_body = outline_copy_stmt(this->else_body,outline,iv);
+
+		copy->next = NULL;
+		*tail = copy;
+		tail = &copy->next;
+	}
+
+	return head;
+}
+
+// Moves the body of the parallel for into a function of the given name,
+// taking the range of iterations to run and an array of the variables it
+// shares with the original function:
+//
+//	name: function void (lo: integer, hi: integer, env: array [] integer) = {
+//		i: integer;
+//		sum: integer = 0;
+//		for(i = lo; i < hi; i++) <body>
+//	}
+//
+// The shared scalars and array addresses are loaded from env on entry, and
+// each sum is added back into it on the way out
+static decl_t *outline_loop(stmt_t *loop, char *name) {
+	symbol_t *iv = loop->init_expr->left->symbol;
+	outline_capture_t *capture;
+	outline_t *outline;
+	arg_t *args, *arg;
+	type_t *integer, *type;
+	decl_t *decl, *decls, *func;
+	expr_t *init, *step, *test;
+	stmt_t *body;
+
+	integer = type_create(TYPE_INTEGER,0,NULL,NULL,false);
+	args = arg_create(str_new("lo",2),integer);
+	args->next = arg_create(str_new("hi",2),integer);
+	args->next->next = arg_create(str_new("env",3),
+		type_create(TYPE_ARRAY,0,NULL,integer,false));
+	type = type_create(TYPE_FUNCTION,0,args,
+		type_create(TYPE_VOID,0,NULL,NULL,false),false);
+
+	func = decl_create(str_new(name,strlen(name)),type,NULL,NULL);
+	func->symbol = symbol_create(func->name,type,SYMBOL_GLOBAL,false,NULL);
+	func->local = true;
+
+	for(arg = args; arg; arg = arg->next)
+		arg->symbol = symbol_create(arg->name,arg->type,SYMBOL_ARG,
+			false,func);
+
+	outline = new(outline_t,{
+		.func = func,
+		.iv = symbol_create(iv->name,iv->type,SYMBOL_LOCAL,false,func)
+	});
+	vector_init(outline->captures);
+	vector_init(outline->locals);
+	vector_append(outlines,outline);
+
+	outline_scan_locals(loop->body,outline);
+	outline_scan_stmt(loop->body,outline,iv);
+	outline->chunked = outline_is_uneven(loop->body,outline,iv);
+
+	// Arrays shared with the original function are passed by address,
+	// just like array arguments
+	decls = decl_create(iv->name,iv->type,NULL,NULL);
+	decls->symbol = outline->iv;
+
+	for(size_t i = outline->captures.n; i-- > 0;) {
+		capture = outline->captures.v + i;
+		capture->inner = symbol_create(capture->outer->name,
+			capture->outer->type,
+			capture->sum ? SYMBOL_LOCAL : SYMBOL_ARG,false,func);
+
+		if(!capture->sum)
+			continue;
+
+		decl = decl_create(capture->outer->name,
+			capture->outer->type,expr_create_integer(0),NULL);
+		decl->symbol = capture->inner;
+		decl->next = decls->next;
+		decls->next = decl;
+	}
+
+	init = expr_create(EXPR_ASSIGN,outline_reference(outline->iv),
+		outline_reference(args->symbol));
+	test = expr_create(EXPR_LT,outline_reference(outline->iv),
+		outline_reference(args->next->symbol));
+	step = expr_create(EXPR_INCREMENT,outline_reference(outline->iv),NULL);
+
+	body = stmt_create(STMT_DECL,decls,NULL,NULL,NULL,NULL,NULL);
+	body->next = stmt_create(STMT_FOR,NULL,init,test,step,
+		outline_copy_stmt(loop->body,outline,iv),NULL);
+	func->body = stmt_create(STMT_BLOCK,NULL,NULL,NULL,NULL,body,NULL);
+
+	// Label everything that was made up above
+	stmt_typecheck(func->body,func);
+
+	loop->outlined = func;
+	return func;
+}
+
+// Outlines the parallel fors among the statements, putting the new functions
+// after the given declaration
+static void outline_stmt(stmt_t *this, decl_t *parent, decl_t **last,
+	size_t *n) {
+	char name[parent->name.n + 32];
+	decl_t *func;
+
+	for(; this; this = this->next) {
+		if(this->op == STMT_FOR && this->parallel) {
+			sprintf(name,"%s$par%zu",parent->name.v,(*n)++);
+			func = outline_loop(this,name);
+
+			func->next = (*last)->next;
+			(*last)->next = func;
+			*last = func;
+			continue;
+		}
+
+		outline_stmt(this->body,parent,last,n);
+		outline_stmt(this->else_body,parent,last,n);
+	}
+}
+
+// Moves the bodies of parallel fors into functions of their own, which the
+// runtime calls on a pool of threads with a range of iterations each
+void outline_loops(decl_t *this) {
+	decl_t *last;
+	size_t n;
+
+	vector_init(outlines);
+
+	for(decl_t *decl = this; decl; decl = last->next) {
+		last = decl;
+		n = 0;
+
+		if(type_is(decl->type,TYPE_FUNCTION) && decl->body)
+			outline_stmt(decl->body,decl,&last,&n);
+	}
+}
+
+// Loads the variables the body shares with its original function from the
+// array it was passed
+void outline_codegen_enter(decl_t *func, FILE *f) {
+	outline_t *outline = outline_find(func);
+	outline_capture_t *capture;
+	int env, reg;
+
+	if(!outline)
+		return;
+
+	env = func->type->args->next->next->symbol->reg;
+
+	for(size_t i = 0; i < outline->captures.n; i++) {
+		capture = outline->captures.v + i;
+		if(capture->sum)
+			continue;
+
+		reg = reg_alloc(f);
+		reg_make_real(env,f);
+		fprintf(f,"\tmov %zu(%s), %s\n",8*i,reg_name(env),reg_name(reg));
+
+		capture->inner->reg = reg;
+		reg_make_persistent(reg);
+		reg_set_lvalue(reg,&capture->inner->reg);
+	}
+}
+
+// Adds what this thread has summed into the totals, which other threads may
+// be adding to at the same time
+void outline_codegen_leave(decl_t *func, FILE *f) {
+	outline_t *outline = outline_find(func);
+	outline_capture_t *capture;
+	int env;
+
+	if(!outline)
+		return;
+
+	env = func->type->args->next->next->symbol->reg;
+
+	for(size_t i = 0; i < outline->captures.n; i++) {
+		capture = outline->captures.v + i;
+		if(!capture->sum)
+			continue;
+
+		reg_make_real(capture->inner->reg,f);
+		reg_make_real(env,f);
+		fprintf(f,"\tlock addq %s, %zu(%s)\n",
+			reg_name(capture->inner->reg),8*i,reg_name(env));
+	}
+}
+
+// Stores a register into a local or argument
+static void outline_codegen_assign(symbol_t *symbol, int reg) {
+	reg_free_persistent(symbol->reg);
+	symbol->reg = reg;
+	reg_make_persistent(reg);
+	reg_set_lvalue(reg,&symbol->reg);
+}
+
+// Runs the parallel for's iterations on the pool of threads, then reads back
+// the sums and leaves the induction variable where the loop would have
+void outline_codegen_call(stmt_t *loop, FILE *f) {
+	outline_t *outline = outline_find(loop->outlined);
+	outline_capture_t *capture;
+	int array, hi, last, lo, reg, subreg;
+
+	reg_block_enter();
+	array = reg_assign_array(outline->captures.n ? outline->captures.n : 1);
+
+	for(size_t i = 0; i < outline->captures.n; i++) {
+		reg = expr_codegen(outline_reference(
+			outline->captures.v[i].outer),f,false,-1);
+		reg_make_temporary(&reg,f);
+		reg_make_real(reg,f);
+
+		subreg = reg_assign_subscript(array,i);
+		fprintf(f,"\tmov %s, %s\n",reg_name(reg),reg_name(subreg));
+		reg_free(subreg);
+		reg_free(reg);
+	}
+
+	lo = expr_codegen(loop->init_expr->right,f,false,-1);
+	reg_make_temporary(&lo,f);
+	hi = expr_codegen(loop->expr->right,f,false,-1);
+	reg_make_temporary(&hi,f);
+
+	// An empty range leaves the induction variable where it started
+	reg_make_real(lo,f);
+	reg_make_real(hi,f);
+	last = reg_alloc(f);
+	fprintf(f,"\tmov %s, %s\n",reg_name(lo),reg_name(last));
+	fprintf(f,"\tcmp %s, %s\n",reg_name(hi),reg_name(last));
+	fprintf(f,"\tcmovl %s, %s\n",reg_name(hi),reg_name(last));
+
+	// The body may read any global
+	promote_codegen_store(NULL,f);
+
+	reg_map_v(9,(int []) {
+		-1, lo, hi, -1, -1, -1, -1, -1, -1
+	},(reg_real_t []) {
+		REG_RDI, REG_RSI, REG_RDX, REG_RCX,
+		REG_R8 , REG_R9 , REG_R10, REG_R11,
+		REG_RAX
+	},f);
+
+	subreg = reg_assign_subscript(array,0);
+	fprintf(f,"\tlea %s(%%rip), %%rdi\n",loop->outlined->name.v);
+	fprintf(f,"\tlea %s, %%rcx\n",reg_name(subreg));
+	fprintf(f,"\tmov $%d, %%r8d\n",outline->chunked);
+	fputs("\tcall parallel_for\n",f);
+	reg_free(subreg);
+	reg_free(lo);
+	reg_free(hi);
+
+	outline_codegen_assign(loop->init_expr->left->symbol,last);
+
+	for(size_t i = 0; i < outline->captures.n; i++) {
+		capture = outline->captures.v + i;
+		if(!capture->sum)
+			continue;
+
+		reg = reg_alloc(f);
+		subreg = reg_assign_subscript(array,i);
+		fprintf(f,"\tmov %s, %s\n",reg_name(subreg),reg_name(reg));
+		reg_free(subreg);
+
+		outline_codegen_assign(capture->outer,reg);
+	}
+
+	reg_free_persistent(array);
+	reg_block_leave();
+}
+
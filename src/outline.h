@@ -0,0 +1,16 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+#include <stdio.h>
+
+#include "decl.h"
+#include "stmt.h"
+
+void outline_loops(decl_t *);
+
+void outline_codegen_enter(decl_t *, FILE *);
+void outline_codegen_leave(decl_t *, FILE *);
+void outline_codegen_call(stmt_t *, FILE *);
+
+#endif
+
@@ -83,8 +83,8 @@ void yyerror(const char *);
 %token TOKEN_AND TOKEN_OR
 
 %token TOKEN_ARRAY TOKEN_BOOLEAN TOKEN_CHAR TOKEN_ELSE TOKEN_FALSE
-%token TOKEN_FOR TOKEN_FUNCTION TOKEN_IF TOKEN_INTEGER TOKEN_PRINT
-%token TOKEN_RETURN TOKEN_STRING TOKEN_TRUE TOKEN_VOID TOKEN_WHILE
+%token TOKEN_FOR TOKEN_FUNCTION TOKEN_IF TOKEN_INTEGER TOKEN_PARALLEL
+%token TOKEN_PRINT TOKEN_RETURN TOKEN_STRING TOKEN_TRUE TOKEN_VOID TOKEN_WHILE
 
 %token <s> TOKEN_IDENTIFIER
 
@@ -283,6 +283,12 @@ stmt_non_decl: stmt_non_decl_other { $$ = $1; }
          TOKEN_SEMICOLON optional_expr TOKEN_RPAREN stmt_non_decl_block {
 	$$ = stmt_create(STMT_FOR,NULL,$3,$5,$7,$9,NULL);
        }
+       | TOKEN_PARALLEL TOKEN_FOR TOKEN_LPAREN optional_expr TOKEN_SEMICOLON
+         optional_expr TOKEN_SEMICOLON optional_expr TOKEN_RPAREN
+         stmt_non_decl_block {
+	$$ = stmt_create(STMT_FOR,NULL,$4,$6,$8,$10,NULL);
+	$$->parallel = true;
+       }
        ;
 
 stmt_non_decl_matched: stmt_non_decl_other { $$ = $1; }
@@ -295,6 +301,12 @@ stmt_non_decl_matched: stmt_non_decl_other { $$ = $1; }
          {
 	$$ = stmt_create(STMT_FOR,NULL,$3,$5,$7,$9,NULL);
        }
+       | TOKEN_PARALLEL TOKEN_FOR TOKEN_LPAREN optional_expr TOKEN_SEMICOLON
+         optional_expr TOKEN_SEMICOLON optional_expr TOKEN_RPAREN
+         stmt_non_decl_matched_block {
+	$$ = stmt_create(STMT_FOR,NULL,$4,$6,$8,$10,NULL);
+	$$->parallel = true;
+       }
        ;
 
 stmt_non_decl_other: expr TOKEN_SEMICOLON {
@@ -0,0 +1,367 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builtin.h"
+#include "decl.h"
+#include "expr.h"
+#include "promote.h"
+#include "reg.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "type.h"
+#include "vector.h"
+
+// Only so many globals are kept in registers at once, leaving the rest for
+// the function's own values
+#define PROMOTE_MAX 4
+
+// References inside a loop count for this many outside it, per level
+#define PROMOTE_LOOP_WEIGHT 8
+
+typedef symbol_t *symbol_ptr_t;
+
+typedef_vector_t(symbol_ptr_t);
+
+// What a function, and everything it calls, may change and read
+typedef struct {
+	decl_t *func;
+
+	vector_t(symbol_ptr_t) mods;
+	vector_t(symbol_ptr_t) refs;
+	vector_t(symbol_ptr_t) calls;
+
+	bool opaque; // Calls something outside the program
+} promote_summary_t;
+
+typedef_vector_t(promote_summary_t);
+
+typedef struct {
+	symbol_t *symbol;
+	size_t weight;
+	bool written;
+	bool passed; // Written while evaluating a call's arguments
+
+	int reg;
+} promote_global_t;
+
+typedef_vector_t(promote_global_t);
+
+static vector_t(promote_summary_t) summaries;
+static vector_t(symbol_ptr_t) externs; // Globals other objects may touch
+
+static vector_t(promote_global_t) promoted; // In the current function
+
+static bool promote_has(vector_t(symbol_ptr_t) *set, symbol_t *symbol) {
+	for(size_t i = 0; i < set->n; i++)
+		if(set->v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+// Returns whether anything new was added
+static bool promote_add(vector_t(symbol_ptr_t) *set, symbol_t *symbol) {
+	if(promote_has(set,symbol))
+		return false;
+
+	vector_append(*set,symbol);
+	return true;
+}
+
+// Returns what is known about the function, or NULL if it is defined outside
+// the program
+static promote_summary_t *promote_summary(symbol_t *symbol) {
+	for(size_t i = 0; i < summaries.n; i++)
+		if(summaries.v[i].func->symbol == symbol)
+			return summaries.v + i;
+
+	return NULL;
+}
+
+static bool promote_is_scalar(symbol_t *symbol) {
+	return symbol->level == SYMBOL_GLOBAL
+		&& !type_is(symbol->type,TYPE_ARRAY)
+		&& !type_is(symbol->type,TYPE_FUNCTION);
+}
+
+// Notes the globals the expressions read and change directly, and what they
+// call
+static void promote_scan_expr(expr_t *this, promote_summary_t *summary) {
+	for(; this; this = this->next) {
+		if(this->op == EXPR_REFERENCE
+			&& promote_is_scalar(this->symbol))
+			promote_add(&summary->refs,this->symbol);
+
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			&& this->left->op == EXPR_REFERENCE
+			&& promote_is_scalar(this->left->symbol))
+			promote_add(&summary->mods,this->left->symbol);
+
+		// Built-ins only touch the arrays they are passed
+		if(this->op == EXPR_CALL && !builtin_is(this->left->symbol))
+			promote_add(&summary->calls,this->left->symbol);
+
+		promote_scan_expr(this->left,summary);
+		promote_scan_expr(this->right,summary);
+	}
+}
+
+static void promote_scan_stmt(stmt_t *this, promote_summary_t *summary) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				promote_scan_expr(decl->value,summary);
+
+		promote_scan_expr(this->init_expr,summary);
+		promote_scan_expr(this->expr,summary);
+		promote_scan_expr(this->next_expr,summary);
+
+		promote_scan_stmt(this->body,summary);
+		promote_scan_stmt(this->else_body,summary);
+	}
+}
+
+// Returns whether something the function calls may change the global
+static bool promote_is_clobbered(promote_summary_t *summary,
+	symbol_t *symbol) {
+	promote_summary_t *callee;
+
+	for(size_t i = 0; i < summary->calls.n; i++) {
+		callee = promote_summary(summary->calls.v[i]);
+
+		// Something outside the program could only see it by name
+		if(!callee || callee->opaque) {
+			if(promote_has(&externs,symbol))
+				return true;
+		} else if(promote_has(&callee->mods,symbol))
+			return true;
+	}
+
+	return false;
+}
+
+// Works out what each function may change and read, including through
+// whatever it calls
+void promote_analyze(decl_t *this) {
+	promote_summary_t *summary, *callee;
+	bool changed;
+
+	vector_init(summaries);
+	vector_init(externs);
+
+	for(decl_t *decl = this; decl; decl = decl->next) {
+		if(!type_is(decl->type,TYPE_FUNCTION)) {
+			if(!decl->local)
+				vector_append(externs,decl->symbol);
+			continue;
+		}
+
+		if(!decl->body)
+			continue;
+
+		vector_append(summaries,(promote_summary_t) {.func = decl});
+		summary = summaries.v + summaries.n - 1;
+		vector_init(summary->mods);
+		vector_init(summary->refs);
+		vector_init(summary->calls);
+
+		promote_scan_stmt(decl->body,summary);
+	}
+
+	// Fold in the callees until nothing changes
+	do {
+		changed = false;
+
+		for(size_t s = 0; s < summaries.n; s++) {
+			summary = summaries.v + s;
+
+			for(size_t c = 0; c < summary->calls.n; c++) {
+				if(!(callee = promote_summary(
+					summary->calls.v[c]))) {
+					changed |= !summary->opaque;
+					summary->opaque = true;
+					continue;
+				}
+
+				changed |= callee->opaque && !summary->opaque;
+				summary->opaque |= callee->opaque;
+
+				for(size_t i = 0; i < callee->mods.n; i++)
+					changed |= promote_add(&summary->mods,
+						callee->mods.v[i]);
+				for(size_t i = 0; i < callee->refs.n; i++)
+					changed |= promote_add(&summary->refs,
+						callee->refs.v[i]);
+			}
+		}
+	} while(changed);
+}
+
+static promote_global_t *promote_find(symbol_t *symbol) {
+	for(size_t i = 0; i < promoted.n; i++)
+		if(promoted.v[i].symbol == symbol)
+			return promoted.v + i;
+
+	return NULL;
+}
+
+// Weighs each global the expressions use by how often it is likely to be
+// used, noting which are written and which are written among arguments
+static void promote_weigh_expr(expr_t *this, size_t weight, bool arg) {
+	promote_global_t *global;
+	expr_t *target;
+
+	for(; this; this = this->next) {
+		target = this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT ? this->left : this;
+
+		if(target->op == EXPR_REFERENCE
+			&& promote_is_scalar(target->symbol)) {
+			if(!(global = promote_find(target->symbol))) {
+				vector_append(promoted,(promote_global_t) {
+					.symbol = target->symbol,
+					.reg = -1
+				});
+				global = promoted.v + promoted.n - 1;
+			}
+
+			global->weight += weight;
+			if(target != this) {
+				global->written = true;
+				global->passed |= arg;
+			}
+		}
+
+		if(target != this->left)
+			promote_weigh_expr(this->left,weight,arg);
+		promote_weigh_expr(this->right,weight,
+			arg || this->op == EXPR_CALL);
+	}
+}
+
+static void promote_weigh_stmt(stmt_t *this, size_t weight) {
+	size_t inner;
+
+	for(; this; this = this->next) {
+		inner = this->op == STMT_FOR
+			? weight*PROMOTE_LOOP_WEIGHT : weight;
+
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				promote_weigh_expr(decl->value,weight,false);
+
+		promote_weigh_expr(this->init_expr,weight,false);
+		promote_weigh_expr(this->expr,inner,false);
+		promote_weigh_expr(this->next_expr,inner,false);
+
+		// The body of a parallel for runs in a function of its own
+		if(!this->outlined)
+			promote_weigh_stmt(this->body,inner);
+		promote_weigh_stmt(this->else_body,weight);
+	}
+}
+
+// Picks the globals most worth keeping in registers, of those which nothing
+// the function calls could change, and lists them in a comment
+void promote_select(decl_t *func, FILE *f) {
+	promote_summary_t *summary = promote_summary(func->symbol);
+	promote_global_t *global, best;
+	size_t n;
+
+	promoted.n = 0;
+	promote_weigh_stmt(func->body,1);
+
+	for(size_t i = 0; i < promoted.n; i++) {
+		global = promoted.v + i;
+
+		// Loading and storing it cost about as much as two accesses
+		if(global->weight <= 2 || global->passed
+			|| promote_is_clobbered(summary,global->symbol))
+			global->weight = 0;
+	}
+
+	// Keep the heaviest, in order
+	for(n = 0; n < promoted.n && n < PROMOTE_MAX; n++) {
+		for(size_t i = n + 1; i < promoted.n; i++)
+			if(promoted.v[i].weight > promoted.v[n].weight) {
+				best = promoted.v[i];
+				promoted.v[i] = promoted.v[n];
+				promoted.v[n] = best;
+			}
+
+		if(!promoted.v[n].weight)
+			break;
+	}
+	promoted.n = n;
+
+	if(!promoted.n)
+		return;
+
+	fputs("\t# globals in registers:",f);
+	for(size_t i = 0; i < promoted.n; i++)
+		fprintf(f," %s",promoted.v[i].symbol->name.v);
+	fputc('\n',f);
+}
+
+// Loads the globals picked for the function into registers
+void promote_codegen_enter(FILE *f) {
+	promote_global_t *global;
+	int mem;
+
+	for(size_t i = 0; i < promoted.n; i++) {
+		global = promoted.v + i;
+
+		mem = reg_assign_global(global->symbol->name);
+		global->reg = reg_alloc(f);
+		fprintf(f,"\tmov %s, %s\n",reg_name(mem),reg_name(global->reg));
+		reg_free(mem);
+
+		reg_make_persistent(global->reg);
+	}
+
+	for(size_t i = 0; i < promoted.n; i++)
+		reg_set_lvalue(promoted.v[i].reg,&promoted.v[i].reg);
+}
+
+// Stores the globals the function has changed back where everything else
+// can see them, before a call to callee or before anything else if it is NULL
+void promote_codegen_store(symbol_t *callee, FILE *f) {
+	promote_summary_t *summary;
+	promote_global_t *global;
+	int mem;
+
+	if(builtin_is(callee))
+		return;
+
+	summary = callee ? promote_summary(callee) : NULL;
+
+	for(size_t i = 0; i < promoted.n; i++) {
+		global = promoted.v + i;
+
+		if(!global->written || summary && !summary->opaque
+			&& !promote_has(&summary->refs,global->symbol))
+			continue;
+
+		// There is no memory-to-memory mov
+		mem = reg_assign_global(global->symbol->name);
+		reg_make_real(global->reg,f);
+		fprintf(f,"\tmovq %s, %s\n",reg_name(global->reg),reg_name(mem));
+		reg_free(mem);
+	}
+}
+
+void promote_codegen_leave(void) {
+	for(size_t i = 0; i < promoted.n; i++)
+		reg_free_persistent(promoted.v[i].reg);
+
+	promoted.n = 0;
+}
+
+// Returns the register a global is being kept in, or -1
+int promote_reg(symbol_t *symbol) {
+	promote_global_t *global = promote_find(symbol);
+
+	return global ? global->reg : -1;
+}
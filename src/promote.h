@@ -0,0 +1,20 @@
+#ifndef PROMOTE_H
+#define PROMOTE_H
+
+#include <stdio.h>
+
+#include "decl.h"
+#include "symbol.h"
+
+void promote_analyze(decl_t *);
+
+void promote_select(decl_t *, FILE *);
+
+void promote_codegen_enter(FILE *);
+void promote_codegen_store(symbol_t *, FILE *);
+void promote_codegen_leave(void);
+
+int promote_reg(symbol_t *);
+
+#endif
+
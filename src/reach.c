@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "decl.h"
+#include "expr.h"
+#include "reach.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "util.h"
+#include "vector.h"
+
+typedef symbol_t *symbol_ptr_t;
+
+typedef_vector_t(symbol_ptr_t);
+
+static vector_t(symbol_ptr_t) reached; // Globals and functions main may use
+
+static bool reach_is_reached(symbol_t *symbol) {
+	for(size_t i = 0; i < reached.n; i++)
+		if(reached.v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+// Notes every global the expressions name, including functions they call
+static void reach_expr(expr_t *this) {
+	for(; this; this = this->next) {
+		if(this->op == EXPR_REFERENCE
+			&& this->symbol->level == SYMBOL_GLOBAL
+			&& !reach_is_reached(this->symbol))
+			vector_append(reached,this->symbol);
+
+		reach_expr(this->left);
+		reach_expr(this->right);
+	}
+}
+
+static void reach_stmt(stmt_t *this) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				reach_expr(decl->value);
+
+		reach_expr(this->init_expr);
+		reach_expr(this->expr);
+		reach_expr(this->next_expr);
+
+		reach_stmt(this->body);
+		reach_stmt(this->else_body);
+	}
+}
+
+// Drops the functions and globals which nothing reachable from main uses,
+// returning what is left of the program; since nothing outside it can use
+// them either, the rest are made local to it
+decl_t *reach_prune(decl_t *this) {
+	decl_t *head, **tail;
+	decl_t *decl;
+
+	vector_init(reached);
+
+	for(decl = this; decl; decl = decl->next)
+		if(decl->body && strcmp(decl->name.v,"main") == 0)
+			vector_append(reached,decl->symbol);
+
+	if(!reached.n)
+		die("a whole program needs a main function");
+
+	// Whatever is reached may reach more, through its body or value
+	for(size_t i = 0; i < reached.n; i++)
+		for(decl = this; decl; decl = decl->next)
+			if(decl->symbol == reached.v[i]) {
+				reach_expr(decl->value);
+				reach_stmt(decl->body);
+			}
+
+	for(tail = &head; this; this = this->next) {
+		if(!reach_is_reached(this->symbol))
+			continue;
+
+		this->local = strcmp(this->name.v,"main") != 0;
+
+		*tail = this;
+		tail = &this->next;
+	}
+	*tail = NULL;
+
+	vector_free(reached);
+
+	return head;
+}
+
@@ -0,0 +1,9 @@
+#ifndef REACH_H
+#define REACH_H
+
+#include "decl.h"
+
+decl_t *reach_prune(decl_t *);
+
+#endif
+
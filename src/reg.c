@@ -1,8 +1,10 @@
+#include <inttypes.h>
 #include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "reg.h"
 #include "util.h"
@@ -23,6 +25,7 @@ typedef struct {
 
 	enum {
 		VREG_ARRAY,
+		VREG_CONSTANT,
 		VREG_FUNCTION,
 		VREG_GLOBAL,
 		VREG_POINTER,
@@ -34,13 +37,17 @@ typedef struct {
 	reg_real_t real;
 
 	bool persistent; // Survives reg_free()?
+	bool remat; // Can be recomputed instead of spilled
 	int *lvalue; // Where the reference keeps its reg
 	int slot; // Location in stack frame
 	int offset; // Element within slot
 	size_t size; // Size for arrays
 	int subreg; // For pointers, the register with the actual pointer
+	bool byte; // For pointers, whether they point to a single byte
+	int64_t value; // For constants
 
 	str_t name; // For globals and functions
+	str_t address; // For rematerializable addresses, the operand of lea
 
 	str_t refstr;
 
@@ -59,6 +66,7 @@ static bool regreals[16];
 
 static size_t framesize; // Number of words of local stack space in block
 static size_t maxframesize; // Number of words of local stack space in function
+static size_t spillsize; // Highest word handed out for spilling
 static vector_t(size_t) framesizes; // Stack space at each block level
 
 static int vregfree;
@@ -87,6 +95,8 @@ static frame_slot_t *frame_slot_alloc() {
 		if(framesize > maxframesize)
 			maxframesize = framesize;
 
+		spillsize = framesize;
+
 		vector_append(frame,(frame_slot_t) {
 			.index = framesize
 		});
@@ -102,12 +112,28 @@ static frame_slot_t *frame_slot_alloc() {
 	return slot;
 }
 
+// Helper function to take a particular slot back off the free list
+static void frame_slot_claim(int slot) {
+	int *link;
+
+	if(frame.v[slot].active)
+		return;
+
+	for(link = &framefree; *link != slot; link = &frame.v[*link].freenext)
+		if(*link < 0) // Should never happen
+			return;
+
+	*link = frame.v[slot].freenext;
+	frame.v[slot].active = true;
+}
+
 // Helper function to get an empty vreg slot
 static vreg_t *vreg_alloc() {
 	vreg_t *vreg;
 
 	if(vregfree < 0) { // Need new slot
 		vector_append(vregs,(vreg_t) {
+			.address = str_new("",0),
 			.refstr = str_new("",0)
 		});
 
@@ -119,6 +145,7 @@ static vreg_t *vreg_alloc() {
 
 	vreg->active = true;
 	vreg->lvalue = NULL;
+	vreg->remat = false;
 
 	// Append to end of LRU list
 	if(vreglrutail < 0) {
@@ -135,10 +162,16 @@ static vreg_t *vreg_alloc() {
 }
 
 static vreg_t vreg_copy(vreg_t vreg) {
+	vreg.address = str_new("",0);
 	vreg.refstr = str_new("",0);
 	return vreg;
 }
 
+// Whether the register was dropped to be recomputed, rather than spilled
+static bool vreg_is_dropped(vreg_t *vreg) {
+	return vreg->type == VREG_REGISTER && !vreg->isreal && vreg->slot < 0;
+}
+
 // Return the virtual register currently residing in slot (if there is one)
 static vreg_t *vreg_in_slot(int slot) {
 	for(size_t i = 0; i < vregs.n; i++)
@@ -200,28 +233,61 @@ static void vreg_move(vreg_t *from, vreg_t *to, FILE *f) {
 	vregtouchable = oldtouchable;
 }
 
-// Helper function to spill the least-recently used actual register
-static reg_real_t vreg_spill_lru(FILE *f) {
-	int lru;
-	vreg_t *vreg;
+// Helper function to take a virtual register out of its actual register
+static void vreg_evict(vreg_t *vreg, FILE *f) {
 	frame_slot_t *slot;
 
-	// Pick the virtual register to spill
-	for(lru = vreglru;
-		lru >= 0 && !reg_is_real(lru); lru = vregs.v[lru].lrunext);
+	// Constants go back to being immediates, and addresses are dropped
+	// until they are next needed
+	if(vreg->remat) {
+		if(vreg->address.n)
+			vreg->slot = -1;
+		else vreg->type = VREG_CONSTANT;
 
-	if(lru < 0) // Should never happen
-		die("registers exhausted");
+		vreg->isreal = false;
+		return;
+	}
 
-	// Spill the register
+	// Otherwise, spill it
 	slot = frame_slot_alloc();
-	fprintf(f,"\tmov %s, %i(%%rbp)\n",reg_name(lru),-8*slot->index);
+	fprintf(f,"\tmov %s, %i(%%rbp)\n",vreg_name(vreg),-8*slot->index);
 
-	vreg = vregs.v + lru;
 	vreg->isreal = false;
 	vreg->slot = slot - frame.v;
+}
+
+// Helper function to spill the least-recently used actual register, or a
+// slightly more recently used one that is cheaper to recompute than reload
+static reg_real_t vreg_spill_lru(FILE *f) {
+	int lru, nchecked, nreal;
+
+	nreal = 0;
+	for(int i = 0; i < 16; i++)
+		nreal += regreals[i];
+
+	// Pick the virtual register to spill from the older half
+	lru = -1;
+	nchecked = 0;
+	for(int i = vreglru; i >= 0 && 2*nchecked < nreal;
+		i = vregs.v[i].lrunext) {
+		if(!vregs.v[i].active || !vregs.v[i].isreal)
+			continue;
+
+		if(lru < 0 || vregs.v[i].remat)
+			lru = i;
+
+		if(vregs.v[i].remat)
+			break;
 
-	return vreg->real;
+		nchecked++;
+	}
+
+	if(lru < 0) // Should never happen
+		die("registers exhausted");
+
+	vreg_evict(vregs.v + lru,f);
+
+	return vregs.v[lru].real;
 }
 
 // Helper function to move a virtual register to the end of the LRU list
@@ -261,6 +327,11 @@ static char *vreg_name(vreg_t *vreg) {
 			"%i(%%rbp",-8*frame.v[vreg->slot].index);
 		break;
 
+	case VREG_CONSTANT:
+		str_ensure_cap(&vreg->refstr,22);
+		sprintf(vreg->refstr.v,"$%"PRIi64,vreg->value);
+		break;
+
 	case VREG_FUNCTION:
 		str_ensure_cap(&vreg->refstr,vreg->name.n);
 		sprintf(vreg->refstr.v,"%s",vreg->name.v);
@@ -280,6 +351,8 @@ static char *vreg_name(vreg_t *vreg) {
 		if(vreg->isreal) {
 			str_ensure_cap(&vreg->refstr,5);
 			sprintf(vreg->refstr.v,"%s",reg_name_real(vreg->real));
+		} else if(vreg->slot < 0) { // Should never happen
+			die("dropped address used before it was recomputed");
 		} else {
 			str_ensure_cap(
 				&vreg->refstr,ceil(log10(INT_MAX)) + 7);
@@ -363,6 +436,7 @@ void reg_reset() {
 	// Reset the stack
 	framesize = 0;
 	maxframesize = 0;
+	spillsize = 0;
 	vector_init(framesizes);
 
 	framefree = -1;
@@ -411,6 +485,24 @@ int reg_alloc(FILE *f) {
 	return vreg - vregs.v;
 }
 
+// Computes address into a new register, which may later be recomputed rather
+// than spilled
+int reg_alloc_address(char *address, FILE *f) {
+	int reg;
+	vreg_t *vreg;
+
+	reg = reg_alloc(f);
+	fprintf(f,"\tlea %s, %s\n",address,reg_name(reg));
+
+	vreg = vregs.v + reg;
+	vreg->remat = true;
+	str_ensure_cap(&vreg->address,strlen(address));
+	vreg->address.n = strlen(address);
+	strcpy(vreg->address.v,address);
+
+	return reg;
+}
+
 // Create a pseudo-register referring to a newly stack-allocated array
 int reg_assign_array(size_t size) {
 	vreg_t *vreg = vreg_alloc();
@@ -434,6 +526,24 @@ int reg_assign_array(size_t size) {
 	return vreg - vregs.v;
 }
 
+// Create a pseudo-register for an immediate operand, if value fits in one
+int reg_assign_constant(int64_t value) {
+	vreg_t *vreg;
+
+	if(value < INT32_MIN || value > INT32_MAX)
+		return -1;
+
+	vreg = vreg_alloc();
+
+	vreg->type = VREG_CONSTANT;
+	vreg->isreal = false;
+	vreg->persistent = false;
+	vreg->slot = -1;
+	vreg->value = value;
+
+	return vreg - vregs.v;
+}
+
 // Create a pseudo-register referring to a function
 int reg_assign_function(str_t name) {
 	vreg_t *vreg = vreg_alloc();
@@ -483,10 +593,20 @@ int reg_assign_pointer(int subreg) {
 	vreg->isreal = false;
 	vreg->persistent = false;
 	vreg->subreg = subreg;
+	vreg->byte = false;
 
 	return vreg - vregs.v;
 }
 
+// Create a pseudo-register referring to the byte pointed to by subreg
+int reg_assign_byte_pointer(int subreg) {
+	int reg = reg_assign_pointer(subreg);
+
+	vregs.v[reg].byte = true;
+
+	return reg;
+}
+
 // Create a virtual register initially referring to the actual register real
 int reg_assign_real(reg_real_t real) {
 	vreg_t *vreg = vreg_alloc();
@@ -531,7 +651,7 @@ void reg_free(int reg) {
 	if(vreg->type == VREG_POINTER)
 		reg_free(vreg->subreg);
 
-	if(vreg->type == VREG_REGISTER) {
+	if(vreg->type == VREG_REGISTER && !vreg_is_dropped(vreg)) {
 		if(vreg->isreal)
 			regreals[vreg->real] = false;
 		else {
@@ -570,6 +690,11 @@ void reg_block_enter() {
 
 void reg_block_leave() {
 	framesize = framesizes.v[--framesizes.n];
+
+	// Spill slots handed out inside the block may still be in use (or on
+	// the free list), so only space below them can be reclaimed
+	if(framesize < spillsize)
+		framesize = spillsize;
 }
 
 // Preserve the locations of all virtual registers with lvalues
@@ -604,8 +729,11 @@ void reg_restore_lvalues(FILE *f) {
 				vregs.v[vi].real = saved.v[si].real;
 				vregs.v[vi].slot = saved.v[si].slot;
 
+				// The slot may have been freed along with the
+				// value which used to be there
 				if(vregs.v[vi].isreal)
 					regreals[vregs.v[vi].real] = true;
+				else frame_slot_claim(vregs.v[vi].slot);
 
 				break;
 			}
@@ -620,11 +748,26 @@ bool reg_is_real(int reg) {
 	return vreg_is_real(vregs.v + reg);
 }
 
+// Returns whether the virtual register is an immediate operand
+bool reg_is_constant(int reg) {
+	return vregs.v[reg].type == VREG_CONSTANT;
+}
+
+// Returns the value of an immediate operand
+int64_t reg_constant_value(int reg) {
+	return vregs.v[reg].value;
+}
+
 // Returns whether the virtual register holds a pointer value
 bool reg_is_pointer(int reg) {
 	return vregs.v[reg].type == VREG_POINTER;
 }
 
+// Returns whether the virtual register refers to a single byte in memory
+bool reg_is_byte(int reg) {
+	return vregs.v[reg].type == VREG_POINTER && vregs.v[reg].byte;
+}
+
 // Returns whether the virtual register represents a persistent (named) value
 bool reg_is_persistent(int reg) {
 	return vregs.v[reg].persistent;
@@ -649,12 +792,26 @@ void reg_make_real(int reg, FILE *f) {
 	if(vreg->type == VREG_POINTER)
 		vreg = vregs.v + vreg->subreg;
 
-	if(vreg_is_real(vreg) || vreg->type != VREG_REGISTER)
+	if(vreg_is_real(vreg) || vreg->type != VREG_REGISTER
+		&& vreg->type != VREG_CONSTANT)
 		return;
 
-	real = vreg_spill_lru(f);
-
-	fprintf(f,"\tmov %s, %s\n",vreg_name(vreg),reg_name_real(real));
+	if(real = reg_find_real(), real == REG_NONE)
+		real = vreg_spill_lru(f);
+
+	if(vreg_is_dropped(vreg)) {
+		vreg_touch(vreg);
+		fprintf(f,"\tlea %s, %s\n",vreg->address.v,reg_name_real(real));
+	} else fprintf(f,"\tmov %s, %s\n",
+		vreg_name(vreg),reg_name_real(real));
+
+	// Constants become ordinary registers once they are loaded, but can
+	// still be recomputed
+	if(vreg->type == VREG_CONSTANT) {
+		vreg->type = VREG_REGISTER;
+		vreg->remat = true;
+		vreg->address.n = 0;
+	}
 
 	vreg->isreal = true;
 	vreg->real = real;
@@ -666,7 +823,8 @@ void reg_make_one_real(int reg1, int reg2, FILE *f) {
 		reg_make_real(reg1,f);
 }
 
-// Convenience function to ensure reg is non-persistent
+// Convenience function to ensure reg is non-persistent (and so can be
+// overwritten)
 void reg_make_temporary(int *reg, FILE *f) {
 	int newreg;
 
@@ -674,11 +832,25 @@ void reg_make_temporary(int *reg, FILE *f) {
 
 	vreg_touch(vreg);
 
-	if(vreg->persistent) {
+	// Only the value of the pointer itself is wanted
+	if(vreg->type == VREG_POINTER) {
+		newreg = vreg->subreg;
+		vreg->subreg = -1;
+		reg_free(*reg);
+		*reg = newreg;
+		vreg = vregs.v + *reg;
+	}
+
+	if(vreg->type == VREG_CONSTANT)
+		reg_make_real(*reg,f);
+	else if(vreg->persistent) {
 		newreg = reg_alloc(f);
 		fprintf(f,"\tmov %s, %s\n",reg_name(*reg),reg_name(newreg));
 		*reg = newreg;
 	}
+
+	// Once it can be overwritten, it can no longer be recomputed
+	vregs.v[*reg].remat = false;
 }
 
 // Convenience function to ensure reg1 is non-persistent
@@ -693,9 +865,11 @@ void reg_make_one_temporary(int *reg1, int *reg2, FILE *f, bool *swapped) {
 	vreg_touch(vreg1);
 	vreg_touch(vreg2);
 
-	// Swap them if reg2 is closer to what we want
-	if(vreg1->persistent && !vreg2->persistent
-		|| !vreg1->persistent && !vreg2->persistent && !vreg1->isreal) {
+	// Swap them if reg2 is closer to what we want, but leave any
+	// immediate as the second operand
+	if(vreg2->type != VREG_CONSTANT && (vreg1->type == VREG_CONSTANT
+		|| vreg1->persistent && !vreg2->persistent
+		|| !vreg1->persistent && !vreg2->persistent && !vreg1->isreal)) {
 		reg = *reg1;
 		*reg1 = *reg2;
 		*reg2 = reg;
@@ -720,6 +894,8 @@ void reg_make_one_temporary(int *reg1, int *reg2, FILE *f, bool *swapped) {
 	// Make sure reg1 is real
 	if(!vreg1->isreal)
 		reg_make_real(*reg1,f);
+
+	vregs.v[*reg1].remat = false;
 }
 
 // Promotes a standard virtual register to a local variable
@@ -729,6 +905,7 @@ void reg_make_persistent(int reg) {
 	vreg_touch(vreg);
 
 	vreg->persistent = true;
+	vreg->remat = false;
 }
 
 // Try to allocate real for the next virtual register
@@ -737,92 +914,138 @@ void reg_hint(reg_real_t real) {
 }
 
 // Move the n virtual registers in regs to the actual registers in reals
-// (or, if a reg is -1, simply vacate the corresponding real)
+// (or, if a reg is -1, simply vacate the corresponding real), as if all the
+// moves happened at once
 void reg_map_v(int n, int *regs, reg_real_t *reals, FILE *f) {
+	int occupant[16]; // Virtual register in each actual register
+	bool target[16]; // Whether each actual register is in reals
+	bool oldtouchable, pending[n];
+	reg_real_t real, scratch;
 	vreg_t *vreg;
-	reg_real_t real;
-	vector_t(reg_real_t) emptyreals;
+	int moved;
 
-	// First, move the regs already in registers
-	for(int i = 0; i < n; i++) {
-		vreg = vregs.v + regs[i];
+	for(int i = 0; i < 16; i++) {
+		occupant[i] = -1;
+		target[i] = false;
+	}
+
+	for(size_t i = 0; i < vregs.n; i++)
+		if(vregs.v[i].active && vregs.v[i].isreal)
+			occupant[vregs.v[i].real] = i;
+
+	for(int i = 0; i < n; i++)
+		target[reals[i]] = true;
 
-		if(regs[i] < 0 || !vreg->isreal || vreg->real == reals[i])
+	oldtouchable = vregtouchable;
+	vregtouchable = false;
+
+	// Reserve the targets, so nothing else is moved into them
+	for(int i = 0; i < n; i++)
+		regreals[reals[i]] = true;
+
+	// First, move anything else out of the way
+	for(int i = 0; i < 16; i++) {
+		if(!target[i] || occupant[i] < 0)
 			continue;
 
-		if(regreals[reals[i]])
-			fprintf(f,"\txchg %s, %s\n",
-				reg_name(regs[i]),reg_name_real(reals[i]));
-		else fprintf(f,"\tmov %s, %s\n",
-			reg_name(regs[i]),reg_name_real(reals[i]));
+		for(moved = 0; moved < n && regs[moved] != occupant[i]; moved++);
+		if(moved < n)
+			continue;
 
-		for(size_t vi = 0; vi < vregs.n; vi++)
-			if(vregs.v[vi].active && vregs.v[vi].isreal
-				&& vregs.v[vi].real == reals[i])
-				vregs.v[vi].real = vreg->real;
+		vreg = vregs.v + occupant[i];
 
-		vreg->real = reals[i];
+		if(real = reg_find_real(), real != REG_NONE) {
+			fprintf(f,"\tmov %s, %s\n",
+				reg_name_real(i),reg_name_real(real));
+			vreg->real = real;
+			occupant[real] = occupant[i];
+		} else vreg_evict(vreg,f);
+
+		occupant[i] = -1;
 	}
 
-	// We now block off the reals to prevent accidentally filling them
+	// Next, shuffle the registers among themselves: a move can go ahead
+	// once nothing still waiting to move sits in its target, and what is
+	// left are cycles, which are broken through a scratch register
 	for(int i = 0; i < n; i++)
-		regreals[i] = true;
+		pending[i] = regs[i] >= 0 && vregs.v[regs[i]].isreal
+			&& vregs.v[regs[i]].real != reals[i];
 
-	// Next, move regs in from the stack
-	for(int i = 0; i < n; i++) {
-		vreg = vregs.v + regs[i];
+	for(;;) {
+		moved = -1;
 
-		if(regs[i] < 0 || vreg->isreal)
-			continue;
+		for(int i = 0; i < n; i++) {
+			if(!pending[i])
+				continue;
 
-		for(size_t vi = 0; vi < vregs.n; vi++) {
-			if(vregs.v[vi].active && vregs.v[vi].isreal
-				&& vregs.v[vi].real == reals[i]) {
-				if(real = reg_find_real(), real == REG_NONE) {
-					fprintf(f,"\txchg %s, %s\n",
-						reg_name(regs[i]),
-						reg_name(vi));
-
-					vregs.v[vi].isreal = false;
-					vregs.v[vi].slot = vreg->slot;
-
-					vreg->isreal = true;
-					vreg->real = reals[i];
-				} else {
-					fprintf(f,"\tmov %s, %s\n",
-						reg_name(vi),
-						reg_name_real(real));
-					fprintf(f,"\tmov %s, %s\n",
-						reg_name(regs[i]),
-						reg_name_real(reals[i]));
-
-					vregs.v[vi].real = real;
-
-					vreg->isreal = true;
-					vreg->real = reals[i];
-				}
-
-				goto next_stack_reg;
+			if(moved < 0)
+				moved = i;
+
+			if(occupant[reals[i]] < 0) {
+				moved = i;
+				break;
 			}
 		}
 
-		fprintf(f,"\tmov %s, %s\n",
-			reg_name(regs[i]),reg_name_real(reals[i]));
+		if(moved < 0)
+			break;
+
+		vreg = vregs.v + regs[moved];
+		real = reals[moved];
+
+		if(occupant[real] < 0) {
+			fprintf(f,"\tmov %s, %s\n",
+				reg_name_real(vreg->real),reg_name_real(real));
+		} else if(scratch = reg_find_real(), scratch != REG_NONE) {
+			fprintf(f,"\tmov %s, %s\n",
+				reg_name_real(vreg->real),reg_name_real(scratch));
+			occupant[scratch] = regs[moved];
+			occupant[vreg->real] = -1;
+			vreg->real = scratch;
+			continue;
+		} else { // Nowhere to put it, so swap instead
+			fprintf(f,"\txchg %s, %s\n",
+				reg_name_real(vreg->real),reg_name_real(real));
+			vregs.v[occupant[real]].real = vreg->real;
+		}
+
+		occupant[vreg->real] = occupant[real];
+		if(occupant[vreg->real] < 0 && !target[vreg->real])
+			regreals[vreg->real] = false;
 
-	next_stack_reg:
-		continue;
+		occupant[real] = regs[moved];
+		vreg->real = real;
+		pending[moved] = false;
 	}
 
-	// Finally, vacate the remaining reals
-	vector_init(emptyreals);
+	// Finally, load what was not in a register to begin with
+	for(int i = 0; i < n; i++) {
+		if(regs[i] < 0 || vregs.v[regs[i]].isreal)
+			continue;
 
-	for(int i = 0; i < n; i++)
-		if(regs[i] < 0)
-			vector_append(emptyreals,reals[i]);
+		vreg = vregs.v + regs[i];
+
+		if(vreg_is_dropped(vreg))
+			fprintf(f,"\tlea %s, %s\n",
+				vreg->address.v,reg_name_real(reals[i]));
+		else fprintf(f,"\tmov %s, %s\n",
+			vreg_name(vreg),reg_name_real(reals[i]));
+
+		if(vreg->type == VREG_CONSTANT) {
+			vreg->type = VREG_REGISTER;
+			vreg->remat = true;
+			vreg->address.n = 0;
+		}
 
-	reg_vacate_v(emptyreals.n,emptyreals.v,f);
+		vreg->isreal = true;
+		vreg->real = reals[i];
+	}
 
-	vector_free(emptyreals);
+	vregtouchable = oldtouchable;
+
+	// The vacated registers are now free for use
+	for(int i = 0; i < n; i++)
+		regreals[reals[i]] = regs[i] >= 0;
 }
 
 // If any of the n actual registers in reals currently hold virtual registers,
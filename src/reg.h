@@ -1,6 +1,7 @@
 #ifndef REG_H
 #define REG_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -34,7 +35,10 @@ void reg_reset(void);
 size_t reg_frame_size(void);
 
 int reg_alloc(FILE *);
+int reg_alloc_address(char *, FILE *);
 int reg_assign_array(size_t);
+int reg_assign_byte_pointer(int);
+int reg_assign_constant(int64_t);
 int reg_assign_function(str_t);
 int reg_assign_global(str_t);
 int reg_assign_local(int);
@@ -51,10 +55,14 @@ void reg_block_leave(void);
 void reg_record_lvalues(void);
 void reg_restore_lvalues(FILE *f);
 
+bool reg_is_byte(int);
+bool reg_is_constant(int);
 bool reg_is_real(int);
 bool reg_is_persistent(int);
 bool reg_is_pointer(int);
 
+int64_t reg_constant_value(int);
+
 int *reg_get_lvalue(int);
 void reg_set_lvalue(int, int *);
 
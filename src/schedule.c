@@ -0,0 +1,580 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reg.h"
+#include "schedule.h"
+#include "str.h"
+#include "vector.h"
+
+// Instructions which can issue in the same cycle
+#define SCHEDULE_WIDTH 4
+
+// Extra cycles for a load to reach its users, and for a stored value to be
+// forwarded to a load from the same place
+#define SCHEDULE_LOAD    4
+#define SCHEDULE_FORWARD 5
+
+// Cycles before the divider can take another division
+#define SCHEDULE_DIVIDE 20
+
+// Execution resources, and how many of each there are per cycle
+enum {
+	UNIT_ALU,
+	UNIT_MUL,
+	UNIT_DIV,
+	UNIT_LOAD,
+	UNIT_STORE,
+
+	UNIT_NONE
+};
+
+static int units[UNIT_NONE] = {
+	[UNIT_ALU] = 4,
+	[UNIT_MUL] = 1,
+	[UNIT_DIV] = 1,
+	[UNIT_LOAD] = 2,
+	[UNIT_STORE] = 1
+};
+
+// What an instruction does with its operands; the last one is the destination
+typedef enum {
+	OP_ADDRESS,  // Computes the address of its memory operand
+	OP_ALU,      // Reads and writes the destination, and sets the flags
+	OP_COMPARE,  // Only reads its operands, and sets the flags
+	OP_CONVERT,  // Sign-extends %rax into %rdx
+	OP_DIVIDE,   // Divides %rdx:%rax, and clobbers the flags
+	OP_EXCHANGE, // Reads and writes both operands
+	OP_MOVE,     // Writes the destination
+	OP_SELECT,   // Conditionally moves, based on the flags
+	OP_SET,      // Writes the flags as a byte
+	OP_VECTOR    // Reads and writes the destination, leaving the flags
+} schedule_kind_t;
+
+static struct {
+	char *name;
+	bool prefix; // Followed by a condition code
+	schedule_kind_t kind;
+	int latency;
+} ops[] = {
+	{"add",    false, OP_ALU,       1},
+	{"and",    false, OP_ALU,       1},
+	{"cmov",   true,  OP_SELECT,    1},
+	{"cmp",    false, OP_COMPARE,   1},
+	{"cmpb",   false, OP_COMPARE,   1},
+	{"cmpq",   false, OP_COMPARE,   1},
+	{"cqo",    false, OP_CONVERT,   1},
+	{"dec",    false, OP_ALU,       1},
+	{"decq",   false, OP_ALU,       1},
+	{"idivq",  false, OP_DIVIDE,   40},
+	{"imul",   false, OP_ALU,       3},
+	{"inc",    false, OP_ALU,       1},
+	{"incq",   false, OP_ALU,       1},
+	{"lea",    false, OP_ADDRESS,   1},
+	{"mov",    false, OP_MOVE,      1},
+	{"movabs", false, OP_MOVE,      1},
+	{"movdqu", false, OP_MOVE,      1},
+	{"movq",   false, OP_MOVE,      1},
+	{"movzx",  false, OP_MOVE,      1},
+	{"neg",    false, OP_ALU,       1},
+	{"not",    false, OP_VECTOR,    1},
+	{"or",     false, OP_ALU,       1},
+	{"pxor",   false, OP_VECTOR,    1},
+	{"sar",    false, OP_ALU,       1},
+	{"set",    true,  OP_SET,       1},
+	{"shl",    false, OP_ALU,       1},
+	{"shr",    false, OP_ALU,       1},
+	{"sub",    false, OP_ALU,       1},
+	{"test",   false, OP_COMPARE,   1},
+	{"xchg",   false, OP_EXCHANGE,  2},
+	{"xor",    false, OP_ALU,       1}
+};
+
+// Names of each register at 64, 32, 16, and 8 bits
+static char *names[][4] = {
+	[REG_RAX] = {"rax", "eax", "ax", "al"},
+	[REG_RBX] = {"rbx", "ebx", "bx", "bl"},
+	[REG_RCX] = {"rcx", "ecx", "cx", "cl"},
+	[REG_RDX] = {"rdx", "edx", "dx", "dl"},
+	[REG_RSI] = {"rsi", "esi", "si", "sil"},
+	[REG_RDI] = {"rdi", "edi", "di", "dil"},
+	[REG_RBP] = {"rbp", "ebp", "bp", "bpl"},
+	[REG_RSP] = {"rsp", "esp", "sp", "spl"},
+	[REG_R8]  = {"r8",  "r8d",  "r8w",  "r8b"},
+	[REG_R9]  = {"r9",  "r9d",  "r9w",  "r9b"},
+	[REG_R10] = {"r10", "r10d", "r10w", "r10b"},
+	[REG_R11] = {"r11", "r11d", "r11w", "r11b"},
+	[REG_R12] = {"r12", "r12d", "r12w", "r12b"},
+	[REG_R13] = {"r13", "r13d", "r13w", "r13b"},
+	[REG_R14] = {"r14", "r14d", "r14w", "r14b"},
+	[REG_R15] = {"r15", "r15d", "r15w", "r15b"}
+};
+
+typedef struct {
+	size_t to;
+	int latency;
+} edge_t;
+
+typedef_vector_t(edge_t);
+
+// One instruction of the block being scheduled
+typedef struct {
+	uint32_t uses, defs; // General registers, then %xmm0-15 from bit 16
+	bool flagsuse, flagsdef;
+
+	bool barrier; // Nothing may move across it
+	bool load, store;
+
+	// Where the memory operand is, as precisely as it is known
+	enum {
+		MEM_ANY,
+		MEM_FRAME, // offset bytes from %rbp
+		MEM_GLOBAL // Somewhere within symbol
+	} mem;
+	long offset;
+	int size;
+	char *symbol;
+	size_t symlen;
+
+	int latency;
+	bool unit[UNIT_NONE];
+
+	vector_t(edge_t) succs;
+	size_t npreds;
+	int earliest; // First cycle all its operands are ready
+	int height; // Cycles from its issue to the end of the block
+	bool done;
+} node_t;
+
+// Returns the register named by the len characters at s, or -1; *partial is
+// set if writing it leaves the rest of the register alone
+static int schedule_register(char *s, size_t len, bool *partial) {
+	if(len >= 4 && strncmp(s,"xmm",3) == 0) {
+		int n = atoi(s + 3);
+		*partial = false;
+		return n >= 0 && n < 16 ? 16 + n : -1;
+	}
+
+	for(size_t r = 0; r < sizeof names/sizeof *names; r++) {
+		for(size_t w = 0; w < 4; w++) {
+			if(strlen(names[r][w]) == len
+				&& strncmp(s,names[r][w],len) == 0) {
+				*partial = w >= 2;
+				return r;
+			}
+		}
+	}
+
+	return -1;
+}
+
+// Sums a displacement made only of numbers, returning false for a symbol
+static bool schedule_displacement(char *s, char *end, long *sum) {
+	char *next;
+
+	for(*sum = 0; s < end; s = next + 1) {
+		*sum += strtol(s,&next,10);
+		if(next == s || next > end)
+			return false;
+		if(next == end)
+			break;
+		if(*next != '+')
+			return false;
+	}
+
+	return true;
+}
+
+// Records what an operand of node reads and writes
+static void schedule_operand(node_t *node, char *op, size_t len, bool read,
+	bool write, bool address) {
+	char *paren, *end, *reg, *comma;
+	bool partial;
+	int r;
+
+	end = op + len;
+
+	switch(*op) {
+	case '$':
+		return;
+
+	case '%':
+		r = schedule_register(op + 1,len - 1,&partial);
+		if(r < 0 || r == REG_RSP) {
+			node->barrier = true;
+			return;
+		}
+
+		if(read || write && partial)
+			node->uses |= (uint32_t) 1 << r;
+		if(write)
+			node->defs |= (uint32_t) 1 << r;
+		return;
+	}
+
+	if(!(paren = memchr(op,'(',len)) || end[-1] != ')') {
+		node->barrier = true;
+		return;
+	}
+
+	// Base and index registers
+	node->mem = MEM_ANY;
+	for(reg = paren + 1; reg < end - 1; reg = comma + 1) {
+		if(!(comma = memchr(reg,',',end - 1 - reg)))
+			comma = end - 1;
+
+		if(comma == reg || *reg != '%')
+			continue;
+
+		if(comma - reg == 4 && strncmp(reg,"%rip",4) == 0) {
+			node->mem = MEM_GLOBAL;
+			node->symbol = op;
+			for(node->symlen = 0; op + node->symlen < paren
+				&& op[node->symlen] != '+'
+				&& op[node->symlen] != '-'; node->symlen++);
+			continue;
+		}
+
+		r = schedule_register(reg + 1,comma - reg - 1,&partial);
+		if(r < 0 || r == REG_RSP) {
+			node->barrier = true;
+			return;
+		}
+
+		node->uses |= (uint32_t) 1 << r;
+
+		if(r == REG_RBP && reg == paren + 1 && comma == end - 1
+			&& schedule_displacement(op,paren,&node->offset))
+			node->mem = MEM_FRAME;
+	}
+
+	if(address)
+		return;
+
+	node->load = read;
+	node->store = write;
+}
+
+// Works out what one instruction depends on and what it costs
+static node_t schedule_parse(char *line) {
+	char *operands[3], *end;
+	size_t lens[3], nops, oplen;
+	schedule_kind_t kind;
+	node_t node;
+	size_t op;
+	int depth;
+
+	node = (node_t) {.size = 8};
+	vector_init(node.succs);
+
+	for(oplen = 0; line[oplen] && !isspace(line[oplen]); oplen++);
+
+	for(op = 0; op < sizeof ops/sizeof *ops; op++) {
+		size_t len = strlen(ops[op].name);
+
+		if(ops[op].prefix ? oplen > len : oplen == len)
+			if(strncmp(line,ops[op].name,len) == 0)
+				break;
+	}
+
+	// Anything else (calls, stack adjustments, string instructions) stays
+	// exactly where it is
+	if(op == sizeof ops/sizeof *ops) {
+		node.barrier = true;
+		return node;
+	}
+
+	kind = ops[op].kind;
+	node.latency = ops[op].latency;
+	node.size = strcmp(ops[op].name,"movdqu") == 0 ? 16 : 8;
+
+	// Split the operands on the commas outside of parentheses
+	for(nops = 0, line += oplen; *line && nops < 3; nops++) {
+		while(isspace(*line))
+			line++;
+
+		for(end = line, depth = 0; *end && (depth || *end != ','); end++)
+			depth += *end == '(' ? 1 : *end == ')' ? -1 : 0;
+
+		operands[nops] = line;
+		for(lens[nops] = end - line; lens[nops]
+			&& isspace(line[lens[nops] - 1]); lens[nops]--);
+
+		line = *end ? end + 1 : end;
+	}
+
+	if(*line) {
+		node.barrier = true;
+		return node;
+	}
+
+	for(size_t i = 0; i < nops; i++) {
+		bool last = i + 1 == nops;
+
+		switch(kind) {
+		case OP_ADDRESS:
+			schedule_operand(&node,operands[i],lens[i],!last,last,
+				!last);
+			break;
+
+		case OP_ALU:
+		case OP_SELECT:
+		case OP_VECTOR:
+			schedule_operand(&node,operands[i],lens[i],true,last,
+				false);
+			break;
+
+		case OP_COMPARE:
+		case OP_CONVERT:
+		case OP_DIVIDE:
+			schedule_operand(&node,operands[i],lens[i],true,false,
+				false);
+			break;
+
+		case OP_EXCHANGE:
+			schedule_operand(&node,operands[i],lens[i],true,true,
+				false);
+			break;
+
+		case OP_MOVE:
+		case OP_SET:
+			schedule_operand(&node,operands[i],lens[i],!last,last,
+				false);
+			break;
+		}
+	}
+
+	switch(kind) {
+	case OP_CONVERT:
+		node.uses |= (uint32_t) 1 << REG_RAX;
+		node.defs |= (uint32_t) 1 << REG_RDX;
+		break;
+
+	case OP_DIVIDE:
+		node.uses |= (uint32_t) 1 << REG_RAX | (uint32_t) 1 << REG_RDX;
+		node.defs |= (uint32_t) 1 << REG_RAX | (uint32_t) 1 << REG_RDX;
+		node.unit[UNIT_DIV] = true;
+		break;
+
+	default:
+		break;
+	}
+
+	node.flagsdef = kind == OP_ALU || kind == OP_COMPARE
+		|| kind == OP_DIVIDE;
+	node.flagsuse = kind == OP_SELECT || kind == OP_SET;
+
+	// Plain loads and stores only need their own ports
+	node.unit[UNIT_ALU] = kind != OP_MOVE || !node.load && !node.store;
+	node.unit[UNIT_MUL] = strcmp(ops[op].name,"imul") == 0;
+	node.unit[UNIT_LOAD] = node.load;
+	node.unit[UNIT_STORE] = node.store;
+
+	if(node.load)
+		node.latency += SCHEDULE_LOAD;
+
+	return node;
+}
+
+// Returns whether two memory operands might overlap
+static bool schedule_overlap(node_t *a, node_t *b) {
+	if(a->mem == MEM_ANY || b->mem == MEM_ANY)
+		return true;
+
+	if(a->mem != b->mem)
+		return false;
+
+	if(a->mem == MEM_FRAME)
+		return a->offset < b->offset + b->size
+			&& b->offset < a->offset + a->size;
+
+	return a->symlen == b->symlen
+		&& strncmp(a->symbol,b->symbol,a->symlen) == 0;
+}
+
+static void schedule_edge(node_t *nodes, size_t from, size_t to, int latency) {
+	vector_append(nodes[from].succs,(edge_t) {to,latency});
+	nodes[to].npreds++;
+}
+
+// Adds an edge for everything that must happen before nodes[i]
+static void schedule_depend(node_t *nodes, size_t i) {
+	node_t *b = nodes + i;
+
+	for(size_t j = 0; j < i; j++) {
+		node_t *a = nodes + j;
+		int latency = -1;
+
+		if(a->barrier || b->barrier)
+			latency = 0;
+
+		if(a->uses & b->defs || a->defs & b->defs)
+			latency = 0;
+
+		if(a->defs & b->uses)
+			latency = a->latency;
+
+		if((a->load || a->store) && (b->load || b->store)
+			&& (a->store || b->store) && schedule_overlap(a,b)) {
+			if(a->store && b->load && latency < SCHEDULE_FORWARD)
+				latency = SCHEDULE_FORWARD;
+			else if(latency < 0)
+				latency = 0;
+		}
+
+		if(latency >= 0)
+			schedule_edge(nodes,j,i,latency);
+	}
+}
+
+// Keeps every flags reader next to the instruction that set its flags: each
+// writer whose flags are read somewhere stays after all the writers before it,
+// and ahead of all the writers after its last reader; the flags are assumed to
+// be read once the block is left
+static void schedule_depend_flags(node_t *nodes, size_t n) {
+	size_t *reader, last;
+
+	reader = calloc(n,sizeof *reader);
+
+	last = n;
+	for(size_t i = 0; i < n; i++) {
+		if(nodes[i].flagsuse || nodes[i].barrier) {
+			if(last < n) {
+				schedule_edge(nodes,last,i,nodes[last].latency);
+				reader[last] = i;
+			}
+		}
+
+		if(nodes[i].flagsdef || nodes[i].barrier)
+			last = i;
+	}
+
+	if(last < n)
+		reader[last] = n;
+
+	for(size_t w = 0; w < n; w++) {
+		if(!reader[w])
+			continue;
+
+		for(size_t x = 0; x < n; x++) {
+			if(x == w || !nodes[x].flagsdef && !nodes[x].barrier)
+				continue;
+
+			if(x < w)
+				schedule_edge(nodes,x,w,0);
+			else if(x > reader[w] && reader[w] < n)
+				schedule_edge(nodes,reader[w],x,0);
+		}
+	}
+
+	free(reader);
+}
+
+// Picks the highest unscheduled instruction that can issue this cycle
+static long schedule_pick(node_t *nodes, size_t n, int cycle, int *avail,
+	int divfree) {
+	long best = -1;
+
+	for(size_t i = 0; i < n; i++) {
+		bool fits = true;
+
+		if(nodes[i].done || nodes[i].npreds
+			|| nodes[i].earliest > cycle)
+			continue;
+
+		for(int u = 0; u < UNIT_NONE; u++)
+			if(nodes[i].unit[u] && !avail[u])
+				fits = false;
+
+		if(!fits || nodes[i].unit[UNIT_DIV] && divfree > cycle)
+			continue;
+
+		if(best < 0 || nodes[i].height > nodes[best].height)
+			best = i;
+	}
+
+	return best;
+}
+
+// Reorders the instructions of a basic block so that those on its critical
+// path issue first and independent ones fill the gaps while they wait on
+// their operands, using a rough model of a recent x86-64 core
+void schedule_block(vector_t(str_t) *lines) {
+	vector_t(str_t) order;
+	int avail[UNIT_NONE];
+	int cycle, width, divfree;
+	node_t *nodes;
+	size_t n;
+
+	if(n = lines->n, n < 3)
+		return;
+
+	nodes = malloc(n*sizeof *nodes);
+
+	for(size_t i = 0; i < n; i++) {
+		nodes[i] = schedule_parse(lines->v[i].v);
+
+		if(nodes[i].barrier) {
+			nodes[i].uses = nodes[i].defs = UINT32_MAX;
+			nodes[i].load = nodes[i].store = true;
+			nodes[i].mem = MEM_ANY;
+			nodes[i].latency = 1;
+			memset(nodes[i].unit,0,sizeof nodes[i].unit);
+		}
+
+		schedule_depend(nodes,i);
+	}
+
+	schedule_depend_flags(nodes,n);
+
+	for(size_t i = n; i-- > 0;) {
+		nodes[i].height = nodes[i].latency;
+
+		for(size_t e = 0; e < nodes[i].succs.n; e++) {
+			edge_t *edge = nodes[i].succs.v + e;
+			int height = edge->latency + nodes[edge->to].height;
+
+			if(height > nodes[i].height)
+				nodes[i].height = height;
+		}
+	}
+
+	vector_init(order);
+
+	for(cycle = 0, divfree = 0; order.n < n; cycle++) {
+		memcpy(avail,units,sizeof avail);
+
+		for(width = 0; width < SCHEDULE_WIDTH; width++) {
+			long i = schedule_pick(nodes,n,cycle,avail,divfree);
+			if(i < 0)
+				break;
+
+			nodes[i].done = true;
+			vector_append(order,lines->v[i]);
+
+			for(int u = 0; u < UNIT_NONE; u++)
+				avail[u] -= nodes[i].unit[u];
+			if(nodes[i].unit[UNIT_DIV])
+				divfree = cycle + SCHEDULE_DIVIDE;
+
+			for(size_t e = 0; e < nodes[i].succs.n; e++) {
+				node_t *succ = nodes + nodes[i].succs.v[e].to;
+				int ready = cycle + nodes[i].succs.v[e].latency;
+
+				succ->npreds--;
+				if(ready > succ->earliest)
+					succ->earliest = ready;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < n; i++)
+		vector_free(nodes[i].succs);
+	free(nodes);
+
+	vector_free(*lines);
+	*lines = order;
+}
+
@@ -0,0 +1,9 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "str.h"
+
+void schedule_block(vector_t(str_t) *);
+
+#endif
+
@@ -0,0 +1,505 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arg.h"
+#include "decl.h"
+#include "expr.h"
+#include "spec.h"
+#include "stmt.h"
+#include "symbol.h"
+#include "type.h"
+#include "vector.h"
+
+// The clones may add this many operations and operands to the program in any
+// case, or this percentage of its size if that is more
+#define SPEC_BUDGET_MIN 256
+#define SPEC_BUDGET_PERCENT 50
+
+// A version of a function for a particular set of constant arguments
+typedef struct {
+	decl_t *func;
+	vector_t(expr_ptr_t) values; // Literal for each argument, or NULL
+	vector_t(expr_ptr_t) calls; // Which it is made for
+
+	decl_t *clone;
+} spec_t;
+
+typedef spec_t *spec_ptr_t;
+typedef decl_t *decl_ptr_t;
+
+typedef_vector_t(spec_ptr_t);
+typedef_vector_t(decl_ptr_t);
+
+static vector_t(decl_ptr_t) funcs; // Every function with a body
+static vector_t(spec_ptr_t) specs;
+
+static decl_t *spec_find(symbol_t *symbol) {
+	for(size_t i = 0; i < funcs.n; i++)
+		if(funcs.v[i]->symbol == symbol)
+			return funcs.v[i];
+
+	return NULL;
+}
+
+// Applies visit to every expression in the statements
+static void spec_walk(stmt_t *this, void (*visit)(expr_t *, void *),
+	void *data) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next)
+				if(decl->value)
+					visit(decl->value,data);
+
+		if(this->init_expr)
+			visit(this->init_expr,data);
+		if(this->expr)
+			visit(this->expr,data);
+		if(this->next_expr)
+			visit(this->next_expr,data);
+
+		spec_walk(this->body,visit,data);
+		spec_walk(this->else_body,visit,data);
+	}
+}
+
+static void spec_count(expr_t *this, void *data) {
+	for(; this; this = this->next) {
+		++*(size_t *) data;
+		spec_count(this->left,data);
+		spec_count(this->right,data);
+	}
+}
+
+// Returns how many operations and operands there are in the statements
+static size_t spec_size(stmt_t *this) {
+	size_t size = 0;
+
+	spec_walk(this,spec_count,&size);
+
+	return size;
+}
+
+// Notes whether the expression reads or writes the argument, or passes
+// anything else in its place when the function calls itself
+static void spec_uses(expr_t *this, void *data) {
+	decl_t *func = ((void **) data)[0];
+	arg_t *param = ((void **) data)[1];
+	int *use = ((void **) data)[2];
+	expr_t *arg;
+	arg_t *p;
+
+	for(; this; this = this->next) {
+		if(this->op == EXPR_REFERENCE && this->symbol == param->symbol)
+			*use |= 1;
+
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT)
+			&& this->left->op == EXPR_REFERENCE
+			&& this->left->symbol == param->symbol)
+			*use |= 2;
+
+		if(this->op == EXPR_CALL && this->left->op == EXPR_REFERENCE
+			&& this->left->symbol == func->symbol) {
+			for(arg = this->right, p = func->type->args;
+				arg && p != param; arg = arg->next, p = p->next);
+
+			if(!arg || arg->op != EXPR_REFERENCE
+				|| arg->symbol != param->symbol)
+				*use |= 2;
+		}
+
+		spec_uses(this->left,data);
+		spec_uses(this->right,data);
+	}
+}
+
+// Returns whether the function reads the argument without ever changing it,
+// so that a constant can stand in for it; recursive calls have to pass it
+// along as it is, so that they can call the same version
+static bool spec_is_foldable(decl_t *func, arg_t *arg) {
+	int use = 0;
+
+	if(!type_is(arg->type,TYPE_BOOLEAN)
+		&& !type_is(arg->type,TYPE_CHARACTER)
+		&& !type_is(arg->type,TYPE_INTEGER))
+		return false;
+
+	spec_walk(func->body,spec_uses,(void *[]) {func, arg, &use});
+
+	return use == 1;
+}
+
+static void *spec_dup(void *p, size_t size) {
+	return memcpy(malloc(size),p,size);
+}
+
+static bool spec_same_value(expr_t *a, expr_t *b) {
+	if(!a || !b)
+		return a == b;
+
+	return a->op == b->op && a->b == b->b && a->c == b->c && a->i == b->i;
+}
+
+// Finds the constant arguments of a call, returning the function or NULL if
+// none of them could be folded
+static decl_t *spec_signature(expr_t *call, vector_t(expr_ptr_t) *values) {
+	decl_t *func;
+	expr_t *arg, *value;
+	arg_t *param;
+	bool any;
+
+	if(call->left->op != EXPR_REFERENCE
+		|| !(func = spec_find(call->left->symbol))
+		|| strcmp(func->name.v,"main") == 0)
+		return NULL;
+
+	values->n = 0;
+	any = false;
+
+	for(arg = call->right, param = func->type->args; arg && param;
+		arg = arg->next, param = param->next) {
+		if(arg->type->constant && spec_is_foldable(func,param)) {
+			// Literals evaluate to themselves, but the values are
+			// freed with the specs
+			if((value = expr_eval_element(arg)) == arg)
+				value = spec_dup(arg,sizeof *arg);
+
+			vector_append(*values,value);
+			any = true;
+		} else vector_append(*values,NULL);
+	}
+
+	return any ? func : NULL;
+}
+
+// Returns the version of the function made for the constants, or NULL
+static spec_t *spec_lookup(decl_t *func, vector_t(expr_ptr_t) *values) {
+	size_t i;
+
+	for(size_t s = 0; s < specs.n; s++) {
+		if(specs.v[s]->func != func)
+			continue;
+
+		for(i = 0; i < values->n; i++)
+			if(!spec_same_value(specs.v[s]->values.v[i],
+				values->v[i]))
+				break;
+
+		if(i == values->n)
+			return specs.v[s];
+	}
+
+	return NULL;
+}
+
+// Groups the calls by their constant arguments
+static void spec_collect(expr_t *this, void *unused) {
+	vector_t(expr_ptr_t) values;
+	decl_t *func;
+	spec_t *spec;
+
+	for(; this; this = this->next) {
+		spec_collect(this->left,unused);
+		spec_collect(this->right,unused);
+
+		if(this->op != EXPR_CALL)
+			continue;
+
+		vector_init(values);
+
+		if(!(func = spec_signature(this,&values))) {
+			vector_free(values);
+			continue;
+		}
+
+		if(!(spec = spec_lookup(func,&values))) {
+			spec = new(spec_t,{.func = func, .values = values});
+			vector_init(spec->calls);
+			vector_append(specs,spec);
+		} else vector_free(values);
+
+		vector_append(spec->calls,this);
+	}
+}
+
+// Points the call at the version of the function made for it
+static void spec_redirect(expr_t *call, spec_t *spec) {
+	call->left->symbol = spec->clone->symbol;
+	call->left->s = spec->clone->name;
+}
+
+// Redirects any call whose constants match a version of the function which
+// has been made
+static void spec_redirect_matching(expr_t *this, void *unused) {
+	vector_t(expr_ptr_t) values;
+	decl_t *func;
+	spec_t *spec;
+
+	for(; this; this = this->next) {
+		spec_redirect_matching(this->left,unused);
+		spec_redirect_matching(this->right,unused);
+
+		if(this->op != EXPR_CALL)
+			continue;
+
+		vector_init(values);
+
+		if((func = spec_signature(this,&values))
+			&& (spec = spec_lookup(func,&values)) && spec->clone)
+			spec_redirect(this,spec);
+
+		vector_free(values);
+	}
+}
+
+// Copies the expressions, replacing the constant arguments with their values
+static expr_t *spec_copy_expr(expr_t *this, spec_t *spec) {
+	expr_t *head = NULL, **tail = &head;
+	expr_t *copy;
+	size_t i;
+	arg_t *arg;
+
+	for(; this; this = this->next) {
+		copy = NULL;
+
+		if(this->op == EXPR_REFERENCE)
+			for(arg = spec->func->type->args, i = 0; arg;
+				arg = arg->next, i++)
+				if(arg->symbol == this->symbol
+					&& spec->values.v[i]) {
+					copy = spec_dup(spec->values.v[i],
+						sizeof *copy);
+					break;
+				}
+
+		if(!copy) {
+			copy = spec_dup(this,sizeof *copy);
+			copy->left = spec_copy_expr(this->left,spec);
+			copy->right = spec_copy_expr(this->right,spec);
+
+			if(copy->left)
+				copy->left->parent = copy;
+			if(copy->right)
+				copy->right->parent = copy;
+		}
+
+		copy->next = NULL;
+		*tail = copy;
+		tail = &copy->next;
+	}
+
+	return head;
+}
+
+static stmt_t *spec_copy_stmt(stmt_t *this, spec_t *spec) {
+	stmt_t *head = NULL, **tail = &head;
+	decl_t **decltail;
+	stmt_t *copy;
+
+	for(; this; this = this->next) {
+		copy = spec_dup(this,sizeof *copy);
+
+		// Locals keep their symbols, which only matter while their
+		// function is being generated
+		for(decltail = &copy->decl; *decltail;
+			decltail = &(*decltail)->next) {
+			*decltail = spec_dup(*decltail,sizeof **decltail);
+			(*decltail)->value = spec_copy_expr((*decltail)->value,
+				spec);
+		}
+
+		copy->init_expr = spec_copy_expr(this->init_expr,spec);
+		copy->expr = spec_copy_expr(this->expr,spec);
+		copy->next_expr = spec_copy_expr(this->next_expr,spec);
+		copy->body = spec_copy_stmt(this->body,spec);
+		copy->else_body = spec_copy_stmt(this->else_body,spec);
+
+		copy->next = NULL;
+		*tail = copy;
+		tail = &copy->next;
+	}
+
+	return head;
+}
+
+// Returns whether the expression is a literal
+static bool spec_is_literal(expr_t *this) {
+	return this && (this->op == EXPR_BOOLEAN || this->op == EXPR_CHARACTER
+		|| this->op == EXPR_INTEGER);
+}
+
+// Replaces operations on literals with their results
+static void spec_fold(expr_t *this, void *unused) {
+	expr_t *value;
+
+	for(; this; this = this->next) {
+		spec_fold(this->left,unused);
+		spec_fold(this->right,unused);
+
+		switch(this->op) {
+		case EXPR_ARRAY:
+		case EXPR_ASSIGN:
+		case EXPR_CALL:
+		case EXPR_DECREMENT:
+		case EXPR_INCREMENT:
+		case EXPR_SUBSCRIPT:
+			continue;
+
+		// Leave dividing by zero, or the smallest integer by -1, to
+		// trap at run time
+		case EXPR_DIVIDE:
+		case EXPR_REMAINDER:
+			if(spec_is_literal(this->right) && (!this->right->i
+				|| this->right->i == -1 && this->left
+				&& spec_is_literal(this->left)
+				&& this->left->i == INT64_MIN))
+				continue;
+			break;
+
+		default:
+			break;
+		}
+
+		// Only the siblings' own operands are literals
+		if(!this->left || !spec_is_literal(this->left)
+			|| this->right && !spec_is_literal(this->right))
+			continue;
+
+		value = expr_eval_element(this);
+
+		this->op = value->op;
+		this->b = value->b;
+		this->c = value->c;
+		this->i = value->i;
+		this->left = this->right = NULL;
+
+		free(value);
+	}
+}
+
+// Drops the branches of ifs whose conditions are now literals
+static void spec_prune(stmt_t *this) {
+	stmt_t *taken;
+
+	for(; this; this = this->next) {
+		spec_prune(this->body);
+		spec_prune(this->else_body);
+
+		if(this->op != STMT_IF_ELSE || this->expr->op != EXPR_BOOLEAN)
+			continue;
+
+		taken = this->expr->b ? this->body : this->else_body;
+
+		this->op = STMT_BLOCK;
+		this->expr = NULL;
+		this->body = taken;
+		this->else_body = NULL;
+	}
+}
+
+// Makes the version of the function for the spec's constants, after the
+// given declaration in the program
+static void spec_clone(spec_t *spec, size_t index, decl_t *after) {
+	decl_t *func = spec->func;
+	char name[func->name.n + 32];
+	decl_t *clone;
+
+	sprintf(name,"%s$spec%zu",func->name.v,index);
+
+	clone = decl_create(str_new(name,strlen(name)),func->type,NULL,NULL);
+	clone->symbol = symbol_create(clone->name,func->type,SYMBOL_GLOBAL,
+		false,NULL);
+	clone->body = spec_copy_stmt(func->body,spec);
+
+	clone->next = after->next;
+	after->next = clone;
+	spec->clone = clone;
+}
+
+// Folds the constants through the function, retyping it both to find what is
+// constant and to relabel what is left
+void spec_simplify(decl_t *func) {
+	stmt_typecheck(func->body,func);
+	spec_walk(func->body,spec_fold,NULL);
+	spec_prune(func->body);
+	stmt_typecheck(func->body,func);
+}
+
+// Makes versions of functions for the constant arguments they are called
+// with, as far as the budget allows, and calls them instead
+void spec_specialize(decl_t *this) {
+	size_t budget, i, size, used;
+	size_t *made;
+	decl_t **last;
+	spec_t *spec;
+
+	vector_init(funcs);
+	vector_init(specs);
+
+	size = 0;
+	for(decl_t *decl = this; decl; decl = decl->next)
+		if(type_is(decl->type,TYPE_FUNCTION) && decl->body) {
+			vector_append(funcs,decl);
+			size += spec_size(decl->body);
+		}
+
+	for(i = 0; i < funcs.n; i++)
+		spec_walk(funcs.v[i]->body,spec_collect,NULL);
+
+	budget = size*SPEC_BUDGET_PERCENT/100;
+	if(budget < SPEC_BUDGET_MIN)
+		budget = SPEC_BUDGET_MIN;
+
+	// The versions with the most calls go first, each after those of the
+	// same function already made
+	made = calloc(funcs.n,sizeof *made);
+	last = calloc(funcs.n,sizeof *last);
+	for(used = 0;;) {
+		spec = NULL;
+		for(size_t s = 0; s < specs.n; s++)
+			if(!specs.v[s]->clone && specs.v[s]->calls.n
+				&& (!spec || specs.v[s]->calls.n
+				> spec->calls.n))
+				spec = specs.v[s];
+
+		if(!spec)
+			break;
+
+		if(size = spec_size(spec->func->body), used + size > budget) {
+			spec->calls.n = 0;
+			continue;
+		}
+		used += size;
+
+		for(i = 0; funcs.v[i] != spec->func; i++);
+		spec_clone(spec,++made[i],last[i] ? last[i] : spec->func);
+		last[i] = spec->clone;
+
+		for(size_t c = 0; c < spec->calls.n; c++)
+			spec_redirect(spec->calls.v[c],spec);
+	}
+	free(last);
+	free(made);
+
+	// Calls within the clones may now match other clones, or themselves
+	for(size_t s = 0; s < specs.n; s++)
+		if(specs.v[s]->clone) {
+			spec_simplify(specs.v[s]->clone);
+			spec_walk(specs.v[s]->clone->body,
+				spec_redirect_matching,NULL);
+		}
+
+	for(size_t s = 0; s < specs.n; s++) {
+		for(i = 0; i < specs.v[s]->values.n; i++)
+			free(specs.v[s]->values.v[i]);
+		vector_free(specs.v[s]->values);
+		vector_free(specs.v[s]->calls);
+		free(specs.v[s]);
+	}
+
+	vector_free(funcs);
+	vector_free(specs);
+}
@@ -0,0 +1,10 @@
+#ifndef SPEC_H
+#define SPEC_H
+
+#include "decl.h"
+
+void spec_simplify(decl_t *);
+void spec_specialize(decl_t *);
+
+#endif
+
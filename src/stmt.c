@@ -1,14 +1,35 @@
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "cminor.h"
 #include "decl.h"
 #include "expr.h"
+#include "loop.h"
+#include "outline.h"
+#include "promote.h"
 #include "reg.h"
 #include "scope.h"
 #include "stmt.h"
+#include "symbol.h"
 #include "type.h"
+#include "vector.h"
 #include "pp_util.h"
 
+typedef symbol_t *symbol_ptr_t;
+
+typedef_vector_t(symbol_ptr_t);
+
+// What the body of a parallel for does with the variables around it
+typedef struct {
+	symbol_t *iv;
+	vector_t(symbol_ptr_t) locals; // Declared inside the body
+	vector_t(symbol_ptr_t) sums; // Only ever added to
+	vector_t(symbol_ptr_t) reads; // Used in any other way
+} stmt_shared_t;
+
+static bool usedprintv = false;
+
 stmt_t *stmt_create(stmt_op_t op, decl_t *decl, expr_t *init_expr,
 	expr_t *expr, expr_t *next_expr, stmt_t *body, stmt_t *else_body) {
 	return new(stmt_t,{
@@ -19,21 +40,218 @@ stmt_t *stmt_create(stmt_op_t op, decl_t *decl, expr_t *init_expr,
 		.next_expr = next_expr,
 		.body = body,
 		.else_body = else_body,
+		.parallel = false,
+		.outlined = NULL,
 		.next = NULL
 	});
 }
 
-void stmt_codegen(stmt_t *this, FILE *f) {
+// Returns whether control never falls off the end of the statement list
+static bool stmt_returns(stmt_t *this) {
+	if(!this)
+		return false;
+
+	while(this->next)
+		this = this->next;
+
+	switch(this->op) {
+	case STMT_BLOCK:
+		return stmt_returns(this->body);
+
+	case STMT_IF_ELSE:
+		return stmt_returns(this->body)
+			&& stmt_returns(this->else_body);
+
+	case STMT_RETURN:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Returns the tag identifying the type of a print argument to print$v
+static char stmt_print_tag(expr_t *expr) {
+	if(expr->op == EXPR_STRING)
+		return 's';
+
+	switch(expr->type->type) {
+	case TYPE_BOOLEAN:   return 'b';
+	case TYPE_CHARACTER: return 'c';
+	case TYPE_INTEGER:   return 'i';
+	case TYPE_STRING:    return 's';
+	default:             return '?'; // Should never happen
+	}
+}
+
+// Prints the arguments with a single call
+static void stmt_codegen_print_call(vector_t(expr_ptr_t) args, FILE *f) {
+	int array, reg, subreg;
+	str_t tags;
+
+	if(!args.n)
+		return;
+
+	// A lone argument goes straight to its own print routine
+	if(args.n == 1) {
+		reg_hint(REG_RDI);
+		reg = expr_codegen(args.v[0],f,false,-1);
+		reg_make_temporary(&reg,f);
+
+		reg_map_v(9,(int []) {
+			reg, -1, -1, -1, -1, -1, -1, -1, -1
+		},(reg_real_t []) {
+			REG_RDI, REG_RSI, REG_RDX, REG_RCX,
+			REG_R8 , REG_R9 , REG_R10, REG_R11,
+			REG_RAX
+		},f);
+
+		switch(stmt_print_tag(args.v[0])) {
+		case 'b': fputs("\tcall print_boolean\n",f);   break;
+		case 'c': fputs("\tcall print_character\n",f); break;
+		case 'i': fputs("\tcall print_integer\n",f);   break;
+		case 's': fputs("\tcall print_string\n",f);    break;
+		}
+
+		reg_free(reg);
+		return;
+	}
+
+	// Otherwise, the values are stored in the frame and described by a
+	// string of type tags
+	reg_block_enter();
+	array = reg_assign_array(args.n);
+
+	vector_init(tags);
+
+	for(size_t i = 0; i < args.n; i++) {
+		reg = expr_codegen(args.v[i],f,false,-1);
+		reg_make_temporary(&reg,f);
+		reg_make_real(reg,f);
+
+		subreg = reg_assign_subscript(array,i);
+		fprintf(f,"\tmov %s, %s\n",reg_name(reg),reg_name(subreg));
+		reg_free(subreg);
+		reg_free(reg);
+
+		str_append_c(&tags,stmt_print_tag(args.v[i]));
+	}
+
+	reg_hint(REG_RDI);
+	reg = expr_codegen(expr_create_string(tags),f,false,-1);
+
+	reg_map_v(9,(int []) {
+		reg, -1, -1, -1, -1, -1, -1, -1, -1
+	},(reg_real_t []) {
+		REG_RDI, REG_RSI, REG_RDX, REG_RCX,
+		REG_R8 , REG_R9 , REG_R10, REG_R11,
+		REG_RAX
+	},f);
+
+	subreg = reg_assign_subscript(array,0);
+	fprintf(f,"\tlea %s, %%rsi\n",reg_name(subreg));
+	fputs("\tcall print$v\n",f);
+	usedprintv = true;
+
+	reg_free(subreg);
+	reg_free(reg);
+	reg_free_persistent(array);
+	reg_block_leave();
+}
+
+// Adjacent constant arguments are printed as one string, and the rest are
+// batched into as few calls as possible; an argument which calls a function
+// must wait for everything before it to be printed, though
+static void stmt_codegen_print(expr_t *expr, FILE *f) {
+	char digits[24];
+	str_t text;
+	expr_t *value;
+	vector_t(expr_ptr_t) args;
+
+	vector_init(args);
+	vector_init(text);
+
+	for(; expr; expr = expr->next) {
+		value = expr->type->constant ? expr_eval_element(expr) : NULL;
+
+		// A null character would end the string early, so it is printed
+		// on its own; a string itself only goes up to its first one
+		if(value && value->op == EXPR_CHARACTER && value->c) {
+			str_append_c(&text,value->c);
+			continue;
+		} else if(value && value->op == EXPR_INTEGER) {
+			snprintf(digits,sizeof digits,"%"PRIi64,value->i);
+			for(char *c = digits; *c; c++)
+				str_append_c(&text,*c);
+			continue;
+		} else if(value && value->op == EXPR_STRING) {
+			for(size_t i = 0; i < value->s.n && value->s.v[i]; i++)
+				str_append_c(&text,value->s.v[i]);
+			continue;
+		}
+
+		if(text.n) {
+			vector_append(args,expr_create_string(text));
+			vector_init(text);
+		}
+
+		if(expr_contains_call(expr)) {
+			stmt_codegen_print_call(args,f);
+			args.n = 0;
+		}
+
+		vector_append(args,expr);
+	}
+
+	if(text.n)
+		vector_append(args,expr_create_string(text));
+
+	stmt_codegen_print_call(args,f);
+
+	vector_free(args);
+}
+
+// Returns the assignment this consists of, if it is a single one to a scalar
+// that is cheap enough to evaluate whether it is needed or not
+static expr_t *stmt_speculable_assign(stmt_t *this) {
+	while(this && this->op == STMT_BLOCK && !this->next)
+		this = this->body;
+
+	if(!this || this->next || this->op != STMT_EXPR
+		|| this->expr->op != EXPR_ASSIGN
+		|| this->expr->left->op != EXPR_REFERENCE
+		|| !expr_is_speculable(this->expr->left)
+		|| !expr_is_speculable(this->expr->right))
+		return NULL;
+
+	return this->expr;
+}
+
+// Sets the flags for a branch on the boolean in reg
+static void stmt_codegen_test(int reg, FILE *f) {
+	if(reg_is_constant(reg))
+		reg_make_real(reg,f);
+
+	if(reg_is_real(reg))
+		fprintf(f,"\ttest %s, %s\n",reg_name_8l(reg),reg_name_8l(reg));
+	else fprintf(f,"\tcmpb $0, %s\n",reg_name(reg));
+}
+
+void stmt_codegen(stmt_t *this, FILE *f, decl_t *func) {
 	static size_t nlabels = 0;
 
 	int reg;
 	size_t label1, label2;
+	bool elsecold, thencold;
+	expr_t *otherwise, *then;
+	loop_t *loop;
+	char *cond;
 
 	while(this) {
 		switch(this->op) {
 		case STMT_BLOCK:
 			reg_block_enter();
-			stmt_codegen(this->body,f);
+			stmt_codegen(this->body,f,func);
 			reg_block_leave();
 			break;
 
@@ -42,106 +260,144 @@ void stmt_codegen(stmt_t *this, FILE *f) {
 			break;
 
 		case STMT_EXPR:
-			reg = expr_codegen(this->expr,f,false,-1);
-			reg_free(reg);
+			expr_codegen_discard(this->expr,f);
 			break;
 
 		case STMT_FOR:
+			// The body runs on the pool of threads instead
+			if(this->outlined) {
+				outline_codegen_call(this,f);
+				break;
+			}
+
 			label1 = nlabels++;
 			label2 = nlabels++;
 
-			reg = expr_codegen(this->init_expr,f,false,-1);
-			reg_free(reg);
+			expr_codegen_discard(this->init_expr,f);
 
-			fprintf(f,".Lstmt_%zu:\n",label1);
+			// Subscripts of the induction variable become pointers, and
+			// elements which stay put are kept in registers
+			loop = loop_codegen_enter(this,f,func);
 
+			// The loop is rotated so that the test sits at the bottom
+			// and each iteration only takes a single backward branch;
+			// both the body and the test put the lvalues back where
+			// they were on entry
 			reg_record_lvalues();
+			reg_record_lvalues();
+
+			if(this->expr)
+				fprintf(f,"\tjmp .Lstmt_%zu\n",label2);
+
+			fprintf(f,".Lloop_%zu:\n",label1);
+
+			stmt_codegen(this->body,f,func);
+
+			if(!loop || !loop->eliminated)
+				expr_codegen_discard(this->next_expr,f);
+			loop_codegen_step(loop,f);
+
+			reg_restore_lvalues(f);
+
+			fprintf(f,".Lstmt_%zu:\n",label2);
 
 			// Empty test expression means infinite loop
-			if(this->expr) {
+			if(cond = loop_codegen_test(loop,f), cond) {
+				reg_restore_lvalues(f);
+
+				fprintf(f,"\tj%s .Lloop_%zu\n",cond,label1);
+			} else if(this->expr) {
 				reg = expr_codegen(this->expr,f,false,-1);
-				fprintf(f,"\ttest %s, %s\n",
-					reg_name_8l(reg),reg_name_8l(reg));
-				fprintf(f,"\tjz .Lstmt_%zu\n",label2);
+				stmt_codegen_test(reg,f);
 				reg_free(reg);
-			}
 
-			stmt_codegen(this->body,f);
+				// Only movs, so the flags survive
+				reg_restore_lvalues(f);
 
-			reg = expr_codegen(this->next_expr,f,false,-1);
-			reg_free(reg);
+				fprintf(f,"\tjnz .Lloop_%zu\n",label1);
+			} else {
+				reg_restore_lvalues(f);
 
-			reg_restore_lvalues(f);
+				fprintf(f,"\tjmp .Lloop_%zu\n",label1);
+			}
 
-			fprintf(f,"\tjmp .Lstmt_%zu\n",label1);
-			fprintf(f,".Lstmt_%zu:\n",label2);
+			loop_codegen_leave(loop,f);
 			break;
 
 		case STMT_IF_ELSE:
+			// Choosing between two values for the same variable needs
+			// no branch at all
+			then = stmt_speculable_assign(this->body);
+			otherwise = this->else_body
+				? stmt_speculable_assign(this->else_body) : NULL;
+
+			if(cminor_cmov && then && !this->expr->effects
+				&& (!this->else_body || otherwise
+				&& otherwise->left->symbol == then->left->symbol)) {
+				expr_codegen_select(then,this->expr,
+					otherwise ? otherwise->right : then->left,f);
+				break;
+			}
+
 			label1 = nlabels++;
 			label2 = nlabels++;
 
+			// Branches ending in an early return are assumed to be
+			// rarely taken, and are moved out of line by the layout
+			thencold = stmt_returns(this->body)
+				&& !stmt_returns(this->else_body);
+			elsecold = stmt_returns(this->else_body)
+				&& !stmt_returns(this->body);
+
 			reg = expr_codegen(this->expr,f,false,-1);
-			fprintf(f,"\ttest %s, %s\n",
-				reg_name_8l(reg),reg_name_8l(reg));
+			stmt_codegen_test(reg,f);
 			fprintf(f,"\tjz .Lstmt_%zu\n",label1);
 			reg_free(reg);
 
 			reg_record_lvalues();
 
-			stmt_codegen(this->body,f);
+			if(thencold)
+				fprintf(f,".Lcold_%zu:\n",label1);
+
+			stmt_codegen(this->body,f,func);
 
 			reg_restore_lvalues(f);
 
 			fprintf(f,"\tjmp .Lstmt_%zu\n",label2);
+
+			if(thencold)
+				fprintf(f,".Lcold_%zu$end:\n",label1);
+
 			fprintf(f,".Lstmt_%zu:\n",label1);
 
 			reg_record_lvalues();
 
-			stmt_codegen(this->else_body,f);
+			if(elsecold)
+				fprintf(f,".Lcold_%zu:\n",label2);
+
+			stmt_codegen(this->else_body,f,func);
 
 			reg_restore_lvalues(f);
 
+			if(elsecold)
+				fprintf(f,".Lcold_%zu$end:\n",label2);
+
 			fprintf(f,".Lstmt_%zu:\n",label2);
 			break;
 
 		case STMT_PRINT:
-			for(expr_t *expr = this->expr;
-				expr; expr = expr->next) {
-				reg_hint(REG_RDI);
-				reg = expr_codegen(expr,f,false,-1);
-				reg_make_temporary(&reg,f);
-
-				reg_map_v(9,(int []) {
-					reg, -1, -1, -1, -1, -1, -1, -1, -1
-				},(reg_real_t []) {
-					REG_RDI, REG_RSI, REG_RDX, REG_RCX,
-					REG_R8 , REG_R9 , REG_R10, REG_R11,
-					REG_RAX
-				},f);
-
-				fprintf(f,"\tcall print_%s\n",
-					  expr->type->type == TYPE_BOOLEAN
-					? "boolean"
-					: expr->type->type == TYPE_CHARACTER
-					? "character"
-					: expr->type->type == TYPE_INTEGER
-					? "integer"
-					: expr->type->type == TYPE_STRING
-					? "string" : "<should never happen>");
-
-				reg_free(reg);
-			}
+			promote_codegen_store(NULL,f);
+			stmt_codegen_print(this->expr,f);
 			break;
 
 		case STMT_RETURN:
 			reg_hint(REG_RAX);
 			reg = expr_codegen(this->expr,f,false,-1);
-			reg_map_v(1,
-				(int []) {reg},(reg_real_t []) {REG_RAX},f);
+			promote_codegen_store(NULL,f);
+			decl_codegen_return(func,reg,f);
 			reg_free(reg);
 
-			fputs("\tjmp 99f\n",f);
+			fprintf(f,"\tjmp .L%s$return\n",func->name.v);
 			break;
 		}
 
@@ -149,6 +405,53 @@ void stmt_codegen(stmt_t *this, FILE *f) {
 	}
 }
 
+// Emits the helpers called by the generated code
+void stmt_print_asm_runtime(FILE *f) {
+	if(!usedprintv)
+		return;
+
+	// Prints the values at %rsi, as described by the tags at %rdi, all
+	// under the one lock in case other threads are printing
+	fputs("\t.text\n"
+		"print$v:\n"
+		"\tpush %rbx\n"
+		"\tpush %r12\n"
+		"\tsub $8, %rsp\n"
+		"\tmov %rdi, %rbx\n"
+		"\tmov %rsi, %r12\n"
+		"\tcall print_lock\n"
+		"1:\n"
+		"\tmovzbl (%rbx), %eax\n"
+		"\ttest %eax, %eax\n"
+		"\tjz 6f\n"
+		"\tmov (%r12), %rdi\n"
+		"\tinc %rbx\n"
+		"\tadd $8, %r12\n"
+		"\tcmp $'i', %eax\n"
+		"\tje 2f\n"
+		"\tcmp $'s', %eax\n"
+		"\tje 3f\n"
+		"\tcmp $'c', %eax\n"
+		"\tje 4f\n"
+		"\tcall print_boolean\n"
+		"\tjmp 1b\n"
+		"2:\n"
+		"\tcall print_integer\n"
+		"\tjmp 1b\n"
+		"3:\n"
+		"\tcall print_string\n"
+		"\tjmp 1b\n"
+		"4:\n"
+		"\tcall print_character\n"
+		"\tjmp 1b\n"
+		"6:\n"
+		"\tcall print_unlock\n"
+		"\tadd $8, %rsp\n"
+		"\tpop %r12\n"
+		"\tpop %rbx\n"
+		"\tret\n",f);
+}
+
 void stmt_print(stmt_t *this, int indent) {
 	char indentstr[indent + 1];
 
@@ -175,7 +478,8 @@ void stmt_print(stmt_t *this, int indent) {
 			break;
 
 		case STMT_FOR:
-			printf("%sfor(",indentstr);
+			printf("%s%sfor(",indentstr,
+				this->parallel ? "parallel " : "");
 			expr_print(this->init_expr);
 			putchar(';');
 			expr_print(this->expr);
@@ -257,6 +561,173 @@ void stmt_resolve(stmt_t *this) {
 	}
 }
 
+// Returns whether the expression mentions the symbol anywhere
+static bool stmt_mentions(expr_t *this, symbol_t *symbol) {
+	for(; this; this = this->next)
+		if(this->op == EXPR_REFERENCE && this->symbol == symbol
+			|| stmt_mentions(this->left,symbol)
+			|| stmt_mentions(this->right,symbol))
+			return true;
+
+	return false;
+}
+
+// Returns the side of the assignment's right-hand side which is added to the
+// variable it assigns, if it is of the form s = s + e or s = e + s and e does
+// not mention s
+static expr_t *stmt_reduction_term(expr_t *this) {
+	expr_t *sum;
+
+	if(this->op != EXPR_ASSIGN || this->left->op != EXPR_REFERENCE
+		|| this->right->op != EXPR_ADD)
+		return NULL;
+
+	sum = this->right;
+
+	if(sum->left->op == EXPR_REFERENCE
+		&& sum->left->symbol == this->left->symbol
+		&& !stmt_mentions(sum->right,this->left->symbol))
+		return sum->right;
+
+	if(sum->right->op == EXPR_REFERENCE
+		&& sum->right->symbol == this->left->symbol
+		&& !stmt_mentions(sum->left,this->left->symbol))
+		return sum->left;
+
+	return NULL;
+}
+
+static bool stmt_has(vector_t(symbol_ptr_t) *set, symbol_t *symbol) {
+	for(size_t i = 0; i < set->n; i++)
+		if(set->v[i] == symbol)
+			return true;
+
+	return false;
+}
+
+// Whether the symbol is declared outside the parallel for being checked
+static bool stmt_is_shared(stmt_shared_t *shared, symbol_t *symbol) {
+	return symbol != shared->iv && !stmt_has(&shared->locals,symbol);
+}
+
+// Checks that the expressions only add to the variables the body of a
+// parallel for shares with the rest of the function
+static void stmt_typecheck_shared_expr(expr_t *this, stmt_shared_t *shared) {
+	expr_t *term;
+	symbol_t *symbol;
+
+	for(; this; this = this->next) {
+		symbol = this->left && this->left->op == EXPR_REFERENCE
+			? this->left->symbol : NULL;
+
+		// Each thread keeps its own sum, and they are added up at
+		// the end
+		if((term = stmt_reduction_term(this))
+			&& stmt_is_shared(shared,symbol)
+			&& symbol->level != SYMBOL_GLOBAL
+			&& type_is(symbol->type,TYPE_INTEGER)) {
+			if(!stmt_has(&shared->sums,symbol))
+				vector_append(shared->sums,symbol);
+
+			stmt_typecheck_shared_expr(term,shared);
+			continue;
+		}
+
+		if((this->op == EXPR_ASSIGN || this->op == EXPR_DECREMENT
+			|| this->op == EXPR_INCREMENT) && symbol
+			&& (symbol == shared->iv
+			|| stmt_is_shared(shared,symbol))) {
+			cminor_errorcount++;
+			printf("type error: cannot change %s, which is declared "
+				"outside the parallel for, except by adding "
+				"to an integer local\n",symbol->name.v);
+		}
+
+		if(this->op == EXPR_REFERENCE
+			&& stmt_is_shared(shared,this->symbol)
+			&& !stmt_has(&shared->reads,this->symbol))
+			vector_append(shared->reads,this->symbol);
+
+		stmt_typecheck_shared_expr(this->left,shared);
+		stmt_typecheck_shared_expr(this->right,shared);
+	}
+}
+
+static void stmt_typecheck_shared(stmt_t *this, stmt_shared_t *shared) {
+	for(; this; this = this->next) {
+		if(this->op == STMT_DECL)
+			for(decl_t *decl = this->decl; decl; decl = decl->next) {
+				stmt_typecheck_shared_expr(decl->value,shared);
+				vector_append(shared->locals,decl->symbol);
+			}
+
+		if(this->op == STMT_FOR && this->parallel) {
+			cminor_errorcount++;
+			printf("type error: parallel for cannot be nested in "
+				"another\n");
+		}
+
+		if(this->op == STMT_PRINT || this->op == STMT_RETURN) {
+			cminor_errorcount++;
+			printf("type error: cannot %s inside a parallel for\n",
+				this->op == STMT_PRINT ? "print" : "return");
+		}
+
+		stmt_typecheck_shared_expr(this->init_expr,shared);
+		stmt_typecheck_shared_expr(this->expr,shared);
+		stmt_typecheck_shared_expr(this->next_expr,shared);
+
+		stmt_typecheck_shared(this->body,shared);
+		stmt_typecheck_shared(this->else_body,shared);
+	}
+}
+
+// A parallel for must count an integer variable up through a range fixed
+// before it starts, and its iterations may only share variables declared
+// outside it by reading them or by adding to them
+static void stmt_typecheck_parallel(stmt_t *this) {
+	stmt_shared_t shared;
+	expr_t *init = this->init_expr;
+	symbol_t *iv;
+
+	iv = init && init->op == EXPR_ASSIGN
+		&& init->left->op == EXPR_REFERENCE
+		? init->left->symbol : NULL;
+
+	if(!iv || iv->level == SYMBOL_GLOBAL
+		|| !type_is(iv->type,TYPE_INTEGER)
+		|| !this->expr || this->expr->op != EXPR_LT
+		|| this->expr->left->op != EXPR_REFERENCE
+		|| this->expr->left->symbol != iv
+		|| !this->next_expr || this->next_expr->op != EXPR_INCREMENT
+		|| this->next_expr->left->op != EXPR_REFERENCE
+		|| this->next_expr->left->symbol != iv) {
+		cminor_errorcount++;
+		printf("type error: parallel for must have the form "
+			"for(i = a; i < b; i++), with i an integer local\n");
+		return;
+	}
+
+	shared.iv = iv;
+	vector_init(shared.locals);
+	vector_init(shared.sums);
+	vector_init(shared.reads);
+
+	stmt_typecheck_shared(this->body,&shared);
+
+	for(size_t i = 0; i < shared.sums.n; i++)
+		if(stmt_has(&shared.reads,shared.sums.v[i])) {
+			cminor_errorcount++;
+			printf("type error: %s is summed by the parallel for, "
+				"so it can only be added to inside it\n",
+				shared.sums.v[i]->name.v);
+		}
+
+	vector_free(shared.locals);
+	vector_free(shared.sums);
+	vector_free(shared.reads);
+}
+
 void stmt_typecheck(stmt_t *this, decl_t *func) {
 	while(this) {
 		switch(this->op) {
@@ -286,6 +757,9 @@ void stmt_typecheck(stmt_t *this, decl_t *func) {
 
 			expr_typecheck(this->next_expr);
 			stmt_typecheck(this->body,func);
+
+			if(this->parallel)
+				stmt_typecheck_parallel(this);
 			break;
 
 		case STMT_IF_ELSE:
@@ -1,6 +1,7 @@
 #ifndef STMT_H
 #define STMT_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 typedef enum {
@@ -22,14 +23,18 @@ typedef struct stmt {
 	struct stmt *body;
 	struct stmt *else_body;
 
+	bool parallel; // A for whose iterations may run on separate threads
+	struct decl *outlined; // The function its body was moved into, if any
+
 	struct stmt *next;
 } stmt_t;
 
 stmt_t *stmt_create(stmt_op_t, struct decl *, struct expr *, struct expr *,
 	struct expr *, stmt_t *, stmt_t *);
 
-void stmt_codegen(stmt_t *, FILE *);
+void stmt_codegen(stmt_t *, FILE *, struct decl *);
 void stmt_print(stmt_t *, int);
+void stmt_print_asm_runtime(FILE *);
 void stmt_resolve(stmt_t *);
 void stmt_typecheck(stmt_t *, struct decl *);
 
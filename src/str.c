@@ -15,8 +15,9 @@ void str_append_c(str_t *this, char c) {
 	this->v[this->n - 1] = c;
 }
 
+// The capacity counts the terminator, which resizing adds room for
 void str_ensure_cap(str_t *this, size_t mincap) {
-	if(this->c < mincap)
+	if(this->c <= mincap)
 		str_resize(this,mincap);
 }
 
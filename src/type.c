@@ -41,10 +41,41 @@ bool type_is(type_t *this, type_type_t type) {
 	return this && this->type == type;
 }
 
+// Returns how many bytes the type takes up as an element of an array; chars
+// and booleans are packed one to a byte, and everything else takes a word
+size_t type_bytes(type_t *this) {
+	switch(this->type) {
+	case TYPE_ARRAY: // Unsized arrays are arguments, passed as pointers
+		return this->size ? this->size*type_bytes(this->subtype) : 8;
+
+	case TYPE_BOOLEAN:
+	case TYPE_CHARACTER:
+		return 1;
+
+	case TYPE_FUNCTION:
+	case TYPE_INTEGER:
+	case TYPE_STRING:
+		return 8;
+
+	case TYPE_VOID:
+		return 0;
+	}
+
+	// Should never happen
+	die("unhandled type type in type_bytes()");
+	return 0;
+}
+
+// Returns whether the type is a single byte when it is an array element
+bool type_is_packed(type_t *this) {
+	return type_is(this,TYPE_BOOLEAN) || type_is(this,TYPE_CHARACTER);
+}
+
+// Returns how many words a variable of the type takes up
 size_t type_size(type_t *this) {
 	switch(this->type) {
 	case TYPE_ARRAY: // Unsized arrays are arguments, passed as pointers
-		return this->size ? this->size*type_size(this->subtype) : 1;
+		return this->size ? (type_bytes(this) + 7)/8 : 1;
 
 	case TYPE_BOOLEAN:
 	case TYPE_CHARACTER:
@@ -31,6 +31,8 @@ type_t *type_clone(type_t *);
 
 bool type_eq(type_t *, type_t *);
 bool type_is(type_t *, type_type_t);
+size_t type_bytes(type_t *);
+bool type_is_packed(type_t *);
 size_t type_size(type_t *);
 
 void type_print(type_t *);
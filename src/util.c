@@ -32,3 +32,15 @@ void error_prefixed(char *prefix, char *msg, ...) {
 	fputc('\n',stderr);
 }
 
+
+void note_prefixed(char *prefix, char *msg, ...) {
+	va_list ap;
+
+	fputs(prefix,stderr);
+
+	va_start(ap,msg);
+	vfprintf(stderr,msg,ap);
+	va_end(ap);
+
+	fputc('\n',stderr);
+}
@@ -8,8 +8,11 @@
 #define error(...)         error_prefixed("error: ",__VA_ARGS__)
 #define resolve_error(...) error_prefixed("resolve error: ",__VA_ARGS__)
 
+#define note(...) note_prefixed("note: ",__VA_ARGS__)
+
 void die_prefixed(char *, char *, ...);
 void error_prefixed(char *, char *, ...);
+void note_prefixed(char *, char *, ...);
 
 #endif
 